@@ -0,0 +1,70 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * Native build only: the part of the Arduino core the pure modules use.
+ */
+
+#ifndef NATIVE_ARDUINO_h
+#define NATIVE_ARDUINO_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+unsigned long millis();
+unsigned long micros();
+
+template <typename A, typename B>
+auto min(A a, B b) -> decltype(a < b ? a : b) {
+	return a < b ? a : b;
+}
+
+template <typename A, typename B>
+auto max(A a, B b) -> decltype(a > b ? a : b) {
+	return a > b ? a : b;
+}
+
+// Stored in network byte order like the ESP32 core, so uint32_t conversions match the device
+class IPAddress {
+   public:
+	IPAddress() : IPAddress(0) {}
+	IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes{a, b, c, d} {}
+	IPAddress(uint32_t address) { memcpy(bytes, &address, sizeof(bytes)); }
+
+	operator uint32_t() const {
+		uint32_t address;
+
+		memcpy(&address, bytes, sizeof(address));
+		return address;
+	}
+
+	bool operator==(const IPAddress &other) const { return memcmp(bytes, other.bytes, sizeof(bytes)) == 0; }
+
+	uint8_t operator[](int index) const { return bytes[index]; }
+	uint8_t &operator[](int index) { return bytes[index]; }
+
+	bool fromString(const char *address);
+
+   private:
+	uint8_t bytes[4];
+};
+
+#endif
@@ -0,0 +1,54 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * Native build only: the lwmqtt types dedup.h needs, no client.
+ */
+
+#ifndef NATIVE_MQTT_h
+#define NATIVE_MQTT_h
+
+#include <Arduino.h>
+
+typedef enum {
+	LWMQTT_SUCCESS = 0,
+	LWMQTT_BUFFER_TOO_SHORT = -1,
+	LWMQTT_REMAINING_LENGTH_OVERFLOW = -3,
+	LWMQTT_MISSING_OR_WRONG_PACKET = -9,
+} lwmqtt_err_t;
+
+typedef enum {
+	LWMQTT_QOS0 = 0,
+	LWMQTT_QOS1 = 1,
+	LWMQTT_QOS2 = 2,
+	LWMQTT_QOS_FAILURE = 128
+} lwmqtt_qos_t;
+
+typedef struct {
+	uint16_t len;
+	char *data;
+} lwmqtt_string_t;
+
+typedef struct {
+	lwmqtt_qos_t qos;
+	bool retained;
+	uint8_t *payload;
+	size_t payload_len;
+} lwmqtt_message_t;
+
+#endif
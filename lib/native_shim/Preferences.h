@@ -0,0 +1,51 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * Native build only: Preferences kept in memory, one store per namespace for the life of the process.
+ */
+
+#ifndef NATIVE_PREFERENCES_h
+#define NATIVE_PREFERENCES_h
+
+#include <Arduino.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class Preferences {
+   public:
+	bool begin(const char *name, bool readOnly = false);
+	void end() {}
+
+	bool clear();
+	bool remove(const char *key);
+
+	size_t putUChar(const char *key, uint8_t value);
+	uint8_t getUChar(const char *key, uint8_t defaultValue = 0);
+
+	size_t putBytes(const char *key, const void *value, size_t length);
+	size_t getBytes(const char *key, void *buffer, size_t length);
+	size_t getBytesLength(const char *key);
+
+   private:
+	std::map<std::string, std::vector<uint8_t>> *store = NULL;
+};
+
+#endif
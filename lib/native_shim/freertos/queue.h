@@ -0,0 +1,31 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NATIVE_FREERTOS_QUEUE_h
+#define NATIVE_FREERTOS_QUEUE_h
+
+#include "freertos/FreeRTOS.h"
+
+// Fixed-size FIFO of item copies, a full queue fails instead of waiting
+typedef struct nativeQueue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(uint32_t length, uint32_t itemSize);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait);
+
+#endif
@@ -0,0 +1,66 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * Native build only: no IP stack, a pcb can never be created.
+ */
+
+#ifndef NATIVE_LWIP_UDP_h
+#define NATIVE_LWIP_UDP_h
+
+#include <Arduino.h>
+
+typedef int8_t err_t;
+#define ERR_OK 0
+#define ERR_IF -12
+
+typedef struct {
+	uint32_t addr;
+} ip_addr_t;
+
+extern const ip_addr_t ip_addr_any;
+#define IP_ADDR_ANY (&ip_addr_any)
+
+struct pbuf;
+struct udp_pcb;
+
+#define SOF_BROADCAST 0x20U
+#define ip_set_option(pcb, opt) ((void)(pcb), (void)(opt))
+
+typedef void (*udp_recv_fn)(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, uint16_t port);
+
+inline struct udp_pcb *udp_new() {
+	return NULL;
+}
+
+inline err_t udp_bind(struct udp_pcb *pcb, const ip_addr_t *address, uint16_t port) {
+	return ERR_IF;
+}
+
+inline void udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *arg) {}
+inline void udp_remove(struct udp_pcb *pcb) {}
+
+inline uint16_t pbuf_copy_partial(const struct pbuf *p, void *data, uint16_t length, uint16_t offset) {
+	return 0;
+}
+
+inline uint8_t pbuf_free(struct pbuf *p) {
+	return 0;
+}
+
+#endif
@@ -0,0 +1,142 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * Native build only: definitions behind the host shims.
+ */
+
+#include <Arduino.h>
+#include <MQTT.h>
+#include <Preferences.h>
+
+#include <chrono>
+#include <deque>
+
+#include "freertos/queue.h"
+#include "lwip/udp.h"
+
+static const std::chrono::steady_clock::time_point nativeStart = std::chrono::steady_clock::now();
+
+unsigned long millis() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - nativeStart).count();
+}
+
+unsigned long micros() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - nativeStart).count();
+}
+
+bool IPAddress::fromString(const char *address) {
+	unsigned int part[4];
+	char trailing;
+
+	if (sscanf(address, "%u.%u.%u.%u%c", &part[0], &part[1], &part[2], &part[3], &trailing) != 4)
+		return false;
+
+	for (int i = 0; i < 4; i++) {
+		if (part[i] > 255)
+			return false;
+
+		bytes[i] = part[i];
+	}
+
+	return true;
+}
+
+const ip_addr_t ip_addr_any = {0};
+
+// The firmware links dedup's wrapper with -Wl,--wrap; natively there is no MQTT client to forward to
+extern "C" lwmqtt_err_t __real_lwmqtt_decode_publish(uint8_t *buf, size_t buf_len, bool *dup, uint16_t *packet_id, lwmqtt_string_t *topic, lwmqtt_message_t *msg) {
+	return LWMQTT_MISSING_OR_WRONG_PACKET;
+}
+
+struct nativeQueue {
+	uint32_t length;
+	uint32_t itemSize;
+	std::deque<std::vector<uint8_t>> items;
+};
+
+QueueHandle_t xQueueCreate(uint32_t length, uint32_t itemSize) {
+	return new nativeQueue{length, itemSize, {}};
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait) {
+	if (queue->items.size() >= queue->length)
+		return pdFALSE;
+
+	const uint8_t *bytes = (const uint8_t *)item;
+	queue->items.emplace_back(bytes, bytes + queue->itemSize);
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait) {
+	if (queue->items.empty())
+		return pdFALSE;
+
+	memcpy(item, queue->items.front().data(), queue->itemSize);
+	queue->items.pop_front();
+	return pdTRUE;
+}
+
+bool Preferences::begin(const char *name, bool readOnly) {
+	static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> namespaces;
+
+	store = &namespaces[name];
+	return true;
+}
+
+bool Preferences::clear() {
+	store->clear();
+	return true;
+}
+
+bool Preferences::remove(const char *key) {
+	return store->erase(key) > 0;
+}
+
+size_t Preferences::putUChar(const char *key, uint8_t value) {
+	return putBytes(key, &value, sizeof(value));
+}
+
+uint8_t Preferences::getUChar(const char *key, uint8_t defaultValue) {
+	uint8_t value;
+
+	return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t length) {
+	const uint8_t *bytes = (const uint8_t *)value;
+
+	(*store)[key].assign(bytes, bytes + length);
+	return length;
+}
+
+size_t Preferences::getBytes(const char *key, void *buffer, size_t length) {
+	auto entry = store->find(key);
+
+	if (entry == store->end() || entry->second.size() > length)
+		return 0;
+
+	memcpy(buffer, entry->second.data(), entry->second.size());
+	return entry->second.size();
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+	auto entry = store->find(key);
+
+	return entry == store->end() ? 0 : entry->second.size();
+}
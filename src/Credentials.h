@@ -42,6 +42,9 @@ const int AWS_PORT = 8883;
 #define TOPIC_ID "1"
 
 const char AWS_WAKE_CHANNEL[] = "wakeChannel/" TOPIC_ID;
+const char AWS_WAKE_CHANNEL_BINARY[] = "wakeChannel/" TOPIC_ID "/bin";  // see wireformat.h
+const char MQTT_PUB_METRICS[] = "wakeChannel/" TOPIC_ID "/metrics";
+const char MQTT_PUB_HEALTH[] = "wakeChannel/" TOPIC_ID "/health";
 const char MQTT_PUB_SHADOW[] = "$aws/things/" THING_NAME "/shadow/update";
 
 // Obtain First CA certificate for Amazon AWS
@@ -0,0 +1,102 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "alloctrace.h"
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t count, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+}
+
+void allocTraceCount();
+
+volatile uint8_t allocTraceActive = 0;
+
+TaskHandle_t allocTraceTasks[ALLOC_TRACE_SLOTS] = {NULL};
+uint32_t allocTraceCounts[ALLOC_TRACE_SLOTS] = {0};
+
+portMUX_TYPE allocTraceMux = portMUX_INITIALIZER_UNLOCKED;
+
+void allocTraceBegin() {
+	TaskHandle_t current = xTaskGetCurrentTaskHandle();
+
+	portENTER_CRITICAL(&allocTraceMux);
+	for (uint8_t i = 0; i < ALLOC_TRACE_SLOTS; i++) {
+		if (allocTraceTasks[i] == NULL) {
+			allocTraceCounts[i] = 0;
+			allocTraceTasks[i] = current;
+			allocTraceActive++;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&allocTraceMux);
+}
+
+uint32_t allocTraceEnd() {
+	TaskHandle_t current = xTaskGetCurrentTaskHandle();
+	uint32_t count = 0;
+
+	portENTER_CRITICAL(&allocTraceMux);
+	for (uint8_t i = 0; i < ALLOC_TRACE_SLOTS; i++) {
+		if (allocTraceTasks[i] == current) {
+			count = allocTraceCounts[i];
+			allocTraceTasks[i] = NULL;
+			allocTraceActive--;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&allocTraceMux);
+
+	return count;
+}
+
+// Only the traced task writes its own counter, so no lock is needed here
+void allocTraceCount() {
+	if (allocTraceActive == 0)
+		return;
+
+	TaskHandle_t current = xTaskGetCurrentTaskHandle();
+
+	for (uint8_t i = 0; i < ALLOC_TRACE_SLOTS; i++) {
+		if (allocTraceTasks[i] == current) {
+			allocTraceCounts[i]++;
+			return;
+		}
+	}
+}
+
+void *__wrap_malloc(size_t size) {
+	allocTraceCount();
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+	allocTraceCount();
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	if (size > 0)
+		allocTraceCount();
+	return __real_realloc(ptr, size);
+}
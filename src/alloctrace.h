@@ -0,0 +1,37 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ALLOCTRACE_h
+#define ALLOCTRACE_h
+
+#include <Arduino.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define ALLOC_TRACE_SLOTS 4  // tasks that can be traced at the same time
+
+/**
+ * Counts heap allocations (malloc/calloc/realloc, including operator new) made by the
+ * calling task between allocTraceBegin() and allocTraceEnd().
+ * Requires the -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc build flags.
+ */
+void allocTraceBegin();
+uint32_t allocTraceEnd();
+
+#endif
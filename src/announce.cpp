@@ -0,0 +1,229 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "announce.h"
+
+#include "lwip/tcpip.h"
+#include "lwip/udp.h"
+
+// ARP header: hardware type, protocol, sizes and opcode, then sender MAC/IP and target MAC/IP
+#define ARP_HEADER_SIZE 28
+#define ARP_SENDER_MAC 8
+#define ARP_SENDER_IP 14
+#define ARP_TARGET_IP 24
+
+// BOOTP header, the DHCP options follow the magic cookie
+#define DHCP_SERVER_PORT 67
+#define DHCP_CIADDR 12
+#define DHCP_CHADDR 28
+#define DHCP_COOKIE 236
+#define DHCP_OPTIONS 240
+#define DHCP_OPTION_PAD 0
+#define DHCP_OPTION_REQUESTED_IP 50
+#define DHCP_OPTION_MESSAGE_TYPE 53
+#define DHCP_OPTION_END 255
+#define DHCP_DISCOVER 1
+#define DHCP_REQUEST 3
+#define DHCP_INFORM 8
+
+QueueHandle_t announceQueue = NULL;
+TaskHandle_t announceNotifyTask = NULL;
+struct udp_pcb *announceDhcpPcb = NULL;
+
+// Read on the tcpip thread, so guarded by a spinlock rather than a mutex
+uint8_t announceWatchList[ANNOUNCE_WATCH_SIZE][MAC_ADDRESS_SIZE];
+bool announceWatchUsed[ANNOUNCE_WATCH_SIZE];
+portMUX_TYPE announceWatchMux = portMUX_INITIALIZER_UNLOCKED;
+
+// DHCP requests are copied here before parsing, only touched on the tcpip thread
+uint8_t announceDhcpBuffer[ANNOUNCE_DHCP_SIZE];
+
+void announceDhcpListen(void *ctx);
+void announceDhcpReceived(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, uint16_t port);
+void announcePush(const announceStruct *announce);
+bool announceWatched(const uint8_t *mac);
+
+bool announceBegin(TaskHandle_t notifyTask) {
+	if (announceQueue == NULL)
+		announceQueue = xQueueCreate(ANNOUNCE_QUEUE_SIZE, sizeof(announceStruct));
+
+	announceNotifyTask = notifyTask;
+
+	if (announceQueue == NULL)
+		return false;
+
+	return tcpip_callback(announceDhcpListen, NULL) == ERR_OK;
+}
+
+bool announceWatch(const uint8_t *mac) {
+	bool watched = false;
+
+	portENTER_CRITICAL(&announceWatchMux);
+	for (uint8_t i = 0; i < ANNOUNCE_WATCH_SIZE && !watched; i++) {
+		if (announceWatchUsed[i] && memcmp(announceWatchList[i], mac, MAC_ADDRESS_SIZE) == 0)
+			watched = true;
+	}
+
+	for (uint8_t i = 0; i < ANNOUNCE_WATCH_SIZE && !watched; i++) {
+		if (!announceWatchUsed[i]) {
+			memcpy(announceWatchList[i], mac, MAC_ADDRESS_SIZE);
+			announceWatchUsed[i] = true;
+			watched = true;
+		}
+	}
+	portEXIT_CRITICAL(&announceWatchMux);
+
+	return watched;
+}
+
+void announceUnwatch(const uint8_t *mac) {
+	portENTER_CRITICAL(&announceWatchMux);
+	for (uint8_t i = 0; i < ANNOUNCE_WATCH_SIZE; i++) {
+		if (announceWatchUsed[i] && memcmp(announceWatchList[i], mac, MAC_ADDRESS_SIZE) == 0)
+			announceWatchUsed[i] = false;
+	}
+	portEXIT_CRITICAL(&announceWatchMux);
+}
+
+bool announceReceive(announceStruct *announce) {
+	if (announceQueue == NULL)
+		return false;
+
+	return xQueueReceive(announceQueue, announce, 0) == pdTRUE;
+}
+
+// Called from the etharp_input() wrap on the tcpip thread, must not block
+void announceArpFrame(const uint8_t *header, size_t length) {
+	announceStruct announce;
+
+	if (announceParseArp(header, length, &announce))
+		announcePush(&announce);
+}
+
+// Gratuitous ARP (sender IP == target IP) or an address probe (sender IP 0), both sent by a host bringing its interface up
+bool announceParseArp(const uint8_t *header, size_t length, announceStruct *announce) {
+	uint32_t senderIP, targetIP;
+
+	if (length < ARP_HEADER_SIZE)
+		return false;
+
+	// Ethernet / IPv4 only
+	if (header[0] != 0 || header[1] != 1 || header[2] != 0x08 || header[3] != 0x00 || header[4] != MAC_ADDRESS_SIZE || header[5] != 4)
+		return false;
+
+	memcpy(&senderIP, header + ARP_SENDER_IP, sizeof(senderIP));
+	memcpy(&targetIP, header + ARP_TARGET_IP, sizeof(targetIP));
+
+	if (senderIP != 0 && senderIP != targetIP)
+		return false;
+
+	memcpy(announce->mac, header + ARP_SENDER_MAC, MAC_ADDRESS_SIZE);
+	announce->ip = senderIP;
+	announce->source = ANNOUNCE_ARP;
+
+	return true;
+}
+
+// Client side DHCP messages only, the IP is the one asked for (option 50) or the one being renewed (ciaddr)
+bool announceParseDhcp(const uint8_t *payload, size_t length, announceStruct *announce) {
+	static const uint8_t cookie[] = {0x63, 0x82, 0x53, 0x63};
+	uint8_t type = 0;
+	uint32_t ip;
+
+	if (length < DHCP_OPTIONS)
+		return false;
+
+	// BOOTREQUEST over Ethernet
+	if (payload[0] != 1 || payload[1] != 1 || payload[2] != MAC_ADDRESS_SIZE || memcmp(payload + DHCP_COOKIE, cookie, sizeof(cookie)) != 0)
+		return false;
+
+	memcpy(&ip, payload + DHCP_CIADDR, sizeof(ip));
+
+	for (size_t i = DHCP_OPTIONS; i < length && payload[i] != DHCP_OPTION_END;) {
+		if (payload[i] == DHCP_OPTION_PAD) {
+			i++;
+			continue;
+		}
+
+		if (i + 2 > length || i + 2 + payload[i + 1] > length)
+			break;
+
+		if (payload[i] == DHCP_OPTION_MESSAGE_TYPE && payload[i + 1] == 1)
+			type = payload[i + 2];
+		else if (payload[i] == DHCP_OPTION_REQUESTED_IP && payload[i + 1] == sizeof(ip))
+			memcpy(&ip, payload + i + 2, sizeof(ip));
+
+		i += 2 + payload[i + 1];
+	}
+
+	if (type != DHCP_DISCOVER && type != DHCP_REQUEST && type != DHCP_INFORM)
+		return false;
+
+	memcpy(announce->mac, payload + DHCP_CHADDR, MAC_ADDRESS_SIZE);
+	announce->ip = ip;
+	announce->source = ANNOUNCE_DHCP;
+
+	return true;
+}
+
+// Runs on the tcpip thread. The DHCP client of the ESP32 itself uses port 68, so 67 is free
+void announceDhcpListen(void *ctx) {
+	if (announceDhcpPcb != NULL)
+		return;
+
+	announceDhcpPcb = udp_new();
+	if (announceDhcpPcb == NULL)
+		return;
+
+	// DISCOVER and REQUEST are broadcast, with IP_SOF_BROADCAST_RECV lwIP only hands those to pcbs that ask for them
+	ip_set_option(announceDhcpPcb, SOF_BROADCAST);
+
+	if (udp_bind(announceDhcpPcb, IP_ADDR_ANY, DHCP_SERVER_PORT) != ERR_OK) {
+		udp_remove(announceDhcpPcb);
+		announceDhcpPcb = NULL;
+		return;
+	}
+
+	udp_recv(announceDhcpPcb, announceDhcpReceived, NULL);
+}
+
+void announceDhcpReceived(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, uint16_t port) {
+	announceStruct announce;
+	uint16_t length = pbuf_copy_partial(p, announceDhcpBuffer, sizeof(announceDhcpBuffer), 0);
+
+	pbuf_free(p);
+
+	if (announceParseDhcp(announceDhcpBuffer, length, &announce))
+		announcePush(&announce);
+}
+
+void announcePush(const announceStruct *announce) {
+	if (announceQueue != NULL && announceWatched(announce->mac) && xQueueSend(announceQueue, announce, 0) == pdTRUE && announceNotifyTask != NULL)
+		xTaskNotifyGive(announceNotifyTask);
+}
+
+bool announceWatched(const uint8_t *mac) {
+	bool watched = false;
+
+	portENTER_CRITICAL(&announceWatchMux);
+	for (uint8_t i = 0; i < ANNOUNCE_WATCH_SIZE && !watched; i++)
+		watched = announceWatchUsed[i] && memcmp(announceWatchList[i], mac, MAC_ADDRESS_SIZE) == 0;
+	portEXIT_CRITICAL(&announceWatchMux);
+
+	return watched;
+}
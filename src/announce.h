@@ -0,0 +1,61 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ANNOUNCE_h
+#define ANNOUNCE_h
+
+#include <Arduino.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "magicpacket.h"
+#include "settings.h"
+
+enum announceSource : uint8_t {
+	ANNOUNCE_ARP = 0,  // gratuitous ARP or RFC 5227 probe
+	ANNOUNCE_DHCP = 1  // DHCPDISCOVER, DHCPREQUEST or DHCPINFORM
+};
+
+struct announceStruct {
+	uint8_t mac[MAC_ADDRESS_SIZE];
+	uint32_t ip;  // network order, 0 when the frame does not tell (ARP probe, fresh DHCPDISCOVER)
+	announceSource source;
+};
+
+/**
+ * Passive confirmation of waking hosts: a booting machine sends a DHCP request and
+ * gratuitous ARP from its own MAC, whether or not its IP is known and even with ICMP blocked.
+ * ARP frames arrive through the etharp_input() wrap in arpprobe.cpp, DHCP through a UDP pcb on port 67.
+ * Announcements from watched MACs are queued and the task given to announceBegin() is notified.
+ *
+ * announceParseArp() and announceParseDhcp() only look at the bytes given, so captured
+ * frames can be fed to them directly.
+ */
+bool announceBegin(TaskHandle_t notifyTask);
+bool announceWatch(const uint8_t *mac);
+void announceUnwatch(const uint8_t *mac);
+bool announceReceive(announceStruct *announce);
+
+void announceArpFrame(const uint8_t *header, size_t length);
+
+bool announceParseArp(const uint8_t *header, size_t length, announceStruct *announce);
+bool announceParseDhcp(const uint8_t *payload, size_t length, announceStruct *announce);
+
+#endif
@@ -0,0 +1,185 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "arpprobe.h"
+
+#include "lwip/def.h"
+#include "lwip/etharp.h"
+#include "lwip/prot/etharp.h"
+#include "lwip/tcpip.h"
+
+#include "announce.h"
+#include "discovery.h"
+
+QueueHandle_t arpFrameQueue = NULL;
+TaskHandle_t arpNotifyTask = NULL;
+
+// Read by etharp_input() on the tcpip thread, so guarded by a spinlock rather than a mutex
+uint32_t arpWatch[ARP_WATCH_SIZE];
+portMUX_TYPE arpWatchMux = portMUX_INITIALIZER_UNLOCKED;
+
+extern "C" err_t __real_etharp_input(struct pbuf *p, struct netif *netif);
+extern "C" err_t __wrap_etharp_input(struct pbuf *p, struct netif *netif);
+
+// Handed to the tcpip thread, one caller at a time (the magic packet sender)
+arpFrameStruct arpStaticPending[ARP_STATIC_SLOTS];
+uint8_t arpStaticNext = 0;
+
+void arpRequest(void *ctx);
+void arpStaticApply(void *ctx);
+void arpStaticDrop(void *ctx);
+bool arpWatched(uint32_t ip);
+
+bool arpProbeBegin(TaskHandle_t notifyTask) {
+	if (arpFrameQueue == NULL)
+		arpFrameQueue = xQueueCreate(ARP_FRAME_QUEUE_SIZE, sizeof(arpFrameStruct));
+
+	arpNotifyTask = notifyTask;
+
+	return arpFrameQueue != NULL;
+}
+
+// Watches ip until arpProbeUnwatch(), then asks lwIP to send the request from the tcpip thread
+bool arpProbeSend(uint32_t ip) {
+	bool watched = false;
+
+	portENTER_CRITICAL(&arpWatchMux);
+	for (uint8_t i = 0; i < ARP_WATCH_SIZE && !watched; i++) {
+		if (arpWatch[i] == ip)
+			watched = true;
+	}
+
+	for (uint8_t i = 0; i < ARP_WATCH_SIZE && !watched; i++) {
+		if (arpWatch[i] == 0) {
+			arpWatch[i] = ip;
+			watched = true;
+		}
+	}
+	portEXIT_CRITICAL(&arpWatchMux);
+
+	if (!watched)
+		return false;
+
+	return arpProbeRequest(ip);
+}
+
+// Request only, the answer just feeds the discovery table
+bool arpProbeRequest(uint32_t ip) {
+	return tcpip_callback(arpRequest, (void *)(uintptr_t)ip) == ERR_OK;
+}
+
+void arpProbeUnwatch(uint32_t ip) {
+	portENTER_CRITICAL(&arpWatchMux);
+	for (uint8_t i = 0; i < ARP_WATCH_SIZE; i++) {
+		if (arpWatch[i] == ip)
+			arpWatch[i] = 0;
+	}
+	portEXIT_CRITICAL(&arpWatchMux);
+}
+
+// The UDP sends that follow go through the tcpip thread after this callback, so a slot
+// is long applied by the time the ring comes back to it
+bool arpStaticAdd(uint32_t ip, const uint8_t *mac) {
+#if ETHARP_SUPPORT_STATIC_ENTRIES
+	arpFrameStruct *entry = &arpStaticPending[arpStaticNext];
+
+	arpStaticNext = (arpStaticNext + 1) % ARP_STATIC_SLOTS;
+
+	entry->ip = ip;
+	memcpy(entry->mac, mac, MAC_ADDRESS_SIZE);
+
+	return tcpip_callback(arpStaticApply, entry) == ERR_OK;
+#else
+	return false;
+#endif
+}
+
+void arpStaticRemove(uint32_t ip) {
+	tcpip_callback(arpStaticDrop, (void *)(uintptr_t)ip);
+}
+
+bool arpProbeReceive(arpFrameStruct *frame) {
+	if (arpFrameQueue == NULL)
+		return false;
+
+	return xQueueReceive(arpFrameQueue, frame, 0) == pdTRUE;
+}
+
+void arpRequest(void *ctx) {
+	ip4_addr_t ip;
+	ip.addr = (uint32_t)(uintptr_t)ctx;
+
+	if (netif_default != NULL)
+		etharp_request(netif_default, &ip);
+}
+
+void arpStaticApply(void *ctx) {
+#if ETHARP_SUPPORT_STATIC_ENTRIES
+	arpFrameStruct *entry = (arpFrameStruct *)ctx;
+	struct eth_addr mac;
+	ip4_addr_t ip;
+
+	ip.addr = entry->ip;
+	memcpy(mac.addr, entry->mac, MAC_ADDRESS_SIZE);
+
+	etharp_add_static_entry(&ip, &mac);
+#endif
+}
+
+void arpStaticDrop(void *ctx) {
+#if ETHARP_SUPPORT_STATIC_ENTRIES
+	ip4_addr_t ip;
+	ip.addr = (uint32_t)(uintptr_t)ctx;
+
+	etharp_remove_static_entry(&ip);
+#endif
+}
+
+bool arpWatched(uint32_t ip) {
+	bool watched = false;
+
+	portENTER_CRITICAL(&arpWatchMux);
+	for (uint8_t i = 0; i < ARP_WATCH_SIZE && !watched; i++)
+		watched = (ip != 0 && arpWatch[i] == ip);
+	portEXIT_CRITICAL(&arpWatchMux);
+
+	return watched;
+}
+
+// Runs on the tcpip thread with the payload at the ARP header, must not block
+err_t __wrap_etharp_input(struct pbuf *p, struct netif *netif) {
+	struct etharp_hdr *header = (struct etharp_hdr *)p->payload;
+
+	if (p->len >= SIZEOF_ETHARP_HDR && header->proto == PP_HTONS(0x0800)) {
+		arpFrameStruct frame;
+
+		memcpy(&frame.ip, &header->sipaddr, sizeof(frame.ip));
+		memcpy(frame.mac, header->shwaddr.addr, MAC_ADDRESS_SIZE);
+
+		discoveryLearn(frame.ip, frame.mac);
+
+		if (arpFrameQueue != NULL && arpWatched(frame.ip) && xQueueSend(arpFrameQueue, &frame, 0) == pdTRUE && arpNotifyTask != NULL)
+			xTaskNotifyGive(arpNotifyTask);
+	}
+
+#if defined(ANNOUNCE_LISTEN)
+	announceArpFrame((const uint8_t *)p->payload, p->len);
+#endif
+
+	return __real_etharp_input(p, netif);
+}
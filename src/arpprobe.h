@@ -0,0 +1,55 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ARPPROBE_h
+#define ARPPROBE_h
+
+#include <Arduino.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "magicpacket.h"
+#include "settings.h"
+
+/**
+ * ARP liveness probe for hosts on the local subnet, answered by the network stack
+ * even when the host firewall drops ICMP echo.
+ * Incoming ARP frames are seen through a linker wrap of etharp_input() (-Wl,--wrap=etharp_input),
+ * so a stale entry in the lwIP ARP table can never confirm a host. Frames from watched IPs
+ * (replies, requests and gratuitous ARP alike) are queued and the task given to arpProbeBegin() is notified.
+ * Every frame also feeds the discovery table.
+ */
+struct arpFrameStruct {
+	uint32_t ip;
+	uint8_t mac[MAC_ADDRESS_SIZE];
+};
+
+bool arpProbeBegin(TaskHandle_t notifyTask);
+bool arpProbeSend(uint32_t ip);
+bool arpProbeRequest(uint32_t ip);
+void arpProbeUnwatch(uint32_t ip);
+bool arpProbeReceive(arpFrameStruct *frame);
+
+// Lets a unicast wake reach a sleeping host that no longer answers ARP, removed again after the burst.
+// False when lwIP lacks ETHARP_SUPPORT_STATIC_ENTRIES or the tcpip queue is full, broadcast instead
+bool arpStaticAdd(uint32_t ip, const uint8_t *mac);
+void arpStaticRemove(uint32_t ip);
+
+#endif
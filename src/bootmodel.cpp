@@ -0,0 +1,138 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bootmodel.h"
+
+#include <Preferences.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+void bootModelKey(uint8_t index, char *key);
+int8_t bootModelFind(const uint8_t *mac);
+
+Preferences bootModelPrefs;
+
+bootModelRecord bootModelTable[BOOT_MODEL_SIZE];
+bool bootModelUsed[BOOT_MODEL_SIZE];
+uint32_t bootModelStamp = 0;
+
+SemaphoreHandle_t bootModelSemaphore = NULL;
+
+void bootModelBegin() {
+	char key[8];
+
+	bootModelSemaphore = xSemaphoreCreateMutex();
+	bootModelPrefs.begin(BOOT_MODEL_NAMESPACE, false);
+
+	if (bootModelPrefs.getUChar("version", 0) != BOOT_MODEL_VERSION) {
+		bootModelPrefs.clear();
+		bootModelPrefs.putUChar("version", BOOT_MODEL_VERSION);
+	}
+
+	for (uint8_t i = 0; i < BOOT_MODEL_SIZE; i++) {
+		bootModelKey(i, key);
+
+		bootModelUsed[i] = bootModelPrefs.getBytesLength(key) == sizeof(bootModelRecord) &&
+						   bootModelPrefs.getBytes(key, &bootModelTable[i], sizeof(bootModelRecord)) == sizeof(bootModelRecord);
+
+		if (bootModelUsed[i] && bootModelTable[i].stamp > bootModelStamp)
+			bootModelStamp = bootModelTable[i].stamp;
+	}
+}
+
+bool bootModelGet(const uint8_t *mac, uint32_t *meanMillis, uint32_t *deviationMillis) {
+	bool found = false;
+
+	xSemaphoreTake(bootModelSemaphore, portMAX_DELAY);
+
+	int8_t index = bootModelFind(mac);
+	if (index >= 0) {
+		*meanMillis = bootModelTable[index].meanMillis;
+		*deviationMillis = bootModelTable[index].deviationMillis;
+		found = true;
+	}
+
+	xSemaphoreGive(bootModelSemaphore);
+
+	return found;
+}
+
+// Moving averages with weight 1/BOOT_MODEL_WEIGHT for the new sample, so a changed machine is relearned in a few wakes
+void bootModelLearn(const uint8_t *mac, uint32_t elapsedMillis) {
+	char key[8];
+
+	xSemaphoreTake(bootModelSemaphore, portMAX_DELAY);
+
+	int8_t index = bootModelFind(mac);
+	bootModelRecord *record;
+
+	if (index < 0) {
+		index = 0;
+
+		for (uint8_t i = 0; i < BOOT_MODEL_SIZE; i++) {
+			if (!bootModelUsed[i]) {
+				index = i;
+				break;
+			}
+
+			if (bootModelTable[i].stamp < bootModelTable[index].stamp)
+				index = i;
+		}
+
+		record = &bootModelTable[index];
+
+		memcpy(record->mac, mac, MAC_ADDRESS_SIZE);
+		record->samples = 0;
+		record->meanMillis = elapsedMillis;
+		record->deviationMillis = elapsedMillis / 4;
+	} else
+		record = &bootModelTable[index];
+
+	if (record->samples > 0) {
+		int32_t error = (int32_t)(elapsedMillis - record->meanMillis);
+
+		record->meanMillis += error / BOOT_MODEL_WEIGHT;
+		record->deviationMillis += ((int32_t)abs(error) - (int32_t)record->deviationMillis) / BOOT_MODEL_WEIGHT;
+	}
+
+	if (record->samples < UINT16_MAX)
+		record->samples++;
+
+	record->stamp = ++bootModelStamp;
+	bootModelUsed[index] = true;
+
+	bootModelKey(index, key);
+	bootModelPrefs.putBytes(key, record, sizeof(bootModelRecord));
+
+	xSemaphoreGive(bootModelSemaphore);
+}
+
+// Caller must hold bootModelSemaphore
+int8_t bootModelFind(const uint8_t *mac) {
+	for (uint8_t i = 0; i < BOOT_MODEL_SIZE; i++) {
+		if (bootModelUsed[i] && memcmp(bootModelTable[i].mac, mac, MAC_ADDRESS_SIZE) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+void bootModelKey(uint8_t index, char *key) {
+	snprintf(key, 8, "m%u", index);
+}
@@ -0,0 +1,48 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BOOTMODEL_h
+#define BOOTMODEL_h
+
+#include <Arduino.h>
+
+#include "magicpacket.h"
+#include "settings.h"
+
+// Stored as-is in NVS, bump BOOT_MODEL_VERSION when the layout changes
+struct bootModelRecord {
+	uint8_t mac[MAC_ADDRESS_SIZE];
+	uint16_t samples;
+
+	uint32_t meanMillis;       // wake -> online, moving average
+	uint32_t deviationMillis;  // moving mean absolute deviation
+
+	uint32_t stamp;  // learn order, the oldest record is replaced when the table is full
+};
+
+/**
+ * Per-MAC wake-to-online time learned from confirmed wakes, persisted in NVS and
+ * mirrored in RAM. Used to place status probes around the expected boot moment.
+ * Safe to call from any task, bootModelLearn() writes flash so keep it off locked paths.
+ */
+void bootModelBegin();
+
+bool bootModelGet(const uint8_t *mac, uint32_t *meanMillis, uint32_t *deviationMillis);
+void bootModelLearn(const uint8_t *mac, uint32_t elapsedMillis);
+
+#endif
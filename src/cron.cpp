@@ -0,0 +1,214 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cron.h"
+
+#include "settings.h"
+
+struct cronMacro {
+	const char *name;
+	const char *expression;
+};
+
+const cronMacro cronMacros[] = {
+	{"@hourly", "0 * * * *"},
+	{"@daily", "0 0 * * *"},
+	{"@midnight", "0 0 * * *"},
+	{"@weekly", "0 0 * * 0"},
+	{"@monthly", "0 0 1 * *"},
+	{"@yearly", "0 0 1 1 *"},
+	{"@annually", "0 0 1 1 *"},
+};
+
+bool cronParseField(const char **cursor, uint8_t low, uint8_t high, uint64_t *bits, bool *any);
+bool cronParseNumber(const char **cursor, uint8_t *value);
+bool cronDayMatches(const cronStruct *cron, const struct tm *t);
+
+bool cronParse(const char *expression, cronStruct *cron) {
+	uint64_t bits;
+	bool any;
+
+	if (expression == NULL)
+		return false;
+
+	for (uint8_t i = 0; i < sizeof(cronMacros) / sizeof(cronMacros[0]); i++) {
+		if (strcmp(expression, cronMacros[i].name) == 0) {
+			expression = cronMacros[i].expression;
+			break;
+		}
+	}
+
+	const char *cursor = expression;
+
+	if (!cronParseField(&cursor, 0, 59, &bits, &any))
+		return false;
+	cron->minutes = bits;
+
+	if (!cronParseField(&cursor, 0, 23, &bits, &any))
+		return false;
+	cron->hours = bits;
+
+	if (!cronParseField(&cursor, 1, 31, &bits, &cron->anyDay))
+		return false;
+	cron->days = bits;
+
+	if (!cronParseField(&cursor, 1, 12, &bits, &any))
+		return false;
+	cron->months = bits;
+
+	if (!cronParseField(&cursor, 0, 7, &bits, &cron->anyWeekday))
+		return false;
+
+	// 7 is Sunday too
+	cron->weekdays = (bits | (bits >> 7)) & 0x7F;
+
+	while (*cursor == ' ')
+		cursor++;
+
+	return *cursor == '\0';
+}
+
+time_t cronNext(const cronStruct *cron, time_t from) {
+	struct tm t;
+
+	// Round up to a whole minute
+	from += 59;
+	from -= from % 60;
+	localtime_r(&from, &t);
+
+	// Skip the largest mismatching unit, mktime() normalizes the overflow into the next one
+	for (uint16_t step = 0; step < CRON_SEARCH_LIMIT; step++) {
+		if (!(cron->months & (1U << (t.tm_mon + 1)))) {
+			t.tm_mon++;
+			t.tm_mday = 1;
+			t.tm_hour = 0;
+			t.tm_min = 0;
+		} else if (!cronDayMatches(cron, &t)) {
+			t.tm_mday++;
+			t.tm_hour = 0;
+			t.tm_min = 0;
+		} else if (!(cron->hours & (1UL << t.tm_hour))) {
+			t.tm_hour++;
+			t.tm_min = 0;
+		} else if (!(cron->minutes & (1ULL << t.tm_min))) {
+			t.tm_min++;
+		} else {
+			return mktime(&t);
+		}
+
+		t.tm_isdst = -1;
+		mktime(&t);
+	}
+
+	return 0;
+}
+
+// One field and the spaces before it, list items are "*", "n", "a-b" with an optional "/step"
+bool cronParseField(const char **cursor, uint8_t low, uint8_t high, uint64_t *bits, bool *any) {
+	const char *c = *cursor;
+
+	while (*c == ' ')
+		c++;
+
+	*bits = 0;
+	*any = *c == '*';
+
+	for (;;) {
+		uint8_t first, last, step = 1;
+		bool single = false;
+
+		if (*c == '*') {
+			first = low;
+			last = high;
+			c++;
+		} else {
+			if (!cronParseNumber(&c, &first))
+				return false;
+
+			last = first;
+			single = *c != '-';
+
+			if (*c == '-') {
+				c++;
+
+				if (!cronParseNumber(&c, &last))
+					return false;
+			}
+		}
+
+		if (*c == '/') {
+			c++;
+
+			if (!cronParseNumber(&c, &step) || step == 0)
+				return false;
+
+			// "a/n" runs to the end of the range
+			if (single)
+				last = high;
+		}
+
+		if (first < low || last > high || first > last)
+			return false;
+
+		for (uint16_t value = first; value <= last; value += step)
+			*bits |= 1ULL << value;
+
+		if (*c != ',')
+			break;
+
+		c++;
+	}
+
+	if (*c != ' ' && *c != '\0')
+		return false;
+
+	*cursor = c;
+	return true;
+}
+
+bool cronParseNumber(const char **cursor, uint8_t *value) {
+	const char *c = *cursor;
+	uint16_t number = 0;
+
+	if (*c < '0' || *c > '9')
+		return false;
+
+	while (*c >= '0' && *c <= '9') {
+		number = number * 10 + (*c++ - '0');
+
+		if (number > 255)
+			return false;
+	}
+
+	*value = number;
+	*cursor = c;
+	return true;
+}
+
+bool cronDayMatches(const cronStruct *cron, const struct tm *t) {
+	bool day = cron->days & (1UL << t->tm_mday);
+	bool weekday = cron->weekdays & (1U << t->tm_wday);
+
+	if (cron->anyDay)
+		return weekday;
+
+	if (cron->anyWeekday)
+		return day;
+
+	return day || weekday;
+}
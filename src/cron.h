@@ -0,0 +1,48 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CRON_h
+#define CRON_h
+
+#include <Arduino.h>
+
+#include <time.h>
+
+/**
+ * Five-field cron expressions, "minute hour day-of-month month day-of-week", in local time.
+ * Each field takes "*", numbers, ranges "a-b", steps ("a-b/n", "a/n", or "*" followed by "/n") and comma lists of them.
+ * Day-of-week 0 and 7 are Sunday. As in Vixie cron, when both day fields are restricted
+ * a day matching either one is enough. "@hourly", "@daily", "@weekly", "@monthly" and "@yearly" are accepted.
+ */
+struct cronStruct {
+	uint64_t minutes;  // bit n set for minute n
+	uint32_t hours;
+	uint32_t days;     // bits 1..31
+	uint16_t months;   // bits 1..12
+	uint8_t weekdays;  // bits 0..6, Sunday first
+
+	bool anyDay;  // day-of-month field started with '*'
+	bool anyWeekday;
+};
+
+bool cronParse(const char *expression, cronStruct *cron);
+
+// First matching minute at or after from, 0 when none is found within CRON_SEARCH_LIMIT steps
+time_t cronNext(const cronStruct *cron, time_t from);
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "deadlineheap.h"
+
+void deadlineHeapSwap(deadlineHeapStruct *heap, uint8_t a, uint8_t b);
+void deadlineHeapSiftUp(deadlineHeapStruct *heap, uint8_t index);
+void deadlineHeapSiftDown(deadlineHeapStruct *heap, uint8_t index);
+
+void deadlineHeapInit(deadlineHeapStruct *heap) {
+	heap->size = 0;
+
+	for (uint8_t i = 0; i < DEADLINE_HEAP_CAPACITY; i++)
+		heap->position[i] = -1;
+}
+
+void deadlineHeapSet(deadlineHeapStruct *heap, uint8_t slot, unsigned long deadline) {
+	int8_t index = heap->position[slot];
+
+	if (index < 0) {
+		index = heap->size++;
+
+		heap->slots[index] = slot;
+		heap->position[slot] = index;
+	}
+
+	heap->deadlines[index] = deadline;
+
+	deadlineHeapSiftUp(heap, index);
+	deadlineHeapSiftDown(heap, heap->position[slot]);
+}
+
+void deadlineHeapRemove(deadlineHeapStruct *heap, uint8_t slot) {
+	int8_t index = heap->position[slot];
+
+	if (index < 0)
+		return;
+
+	uint8_t last = --heap->size;
+
+	if (index != last) {
+		deadlineHeapSwap(heap, index, last);
+
+		deadlineHeapSiftUp(heap, index);
+		deadlineHeapSiftDown(heap, index);
+	}
+
+	heap->position[slot] = -1;
+}
+
+bool deadlineHeapPeek(deadlineHeapStruct *heap, uint8_t *slot, unsigned long *deadline) {
+	if (heap->size == 0)
+		return false;
+
+	*slot = heap->slots[0];
+	*deadline = heap->deadlines[0];
+	return true;
+}
+
+bool deadlineBefore(unsigned long a, unsigned long b) {
+	return (long)(a - b) < 0;
+}
+
+bool deadlineReached(unsigned long deadline, unsigned long now) {
+	return (long)(now - deadline) >= 0;
+}
+
+void deadlineHeapSwap(deadlineHeapStruct *heap, uint8_t a, uint8_t b) {
+	uint8_t slot = heap->slots[a];
+	unsigned long deadline = heap->deadlines[a];
+
+	heap->slots[a] = heap->slots[b];
+	heap->deadlines[a] = heap->deadlines[b];
+
+	heap->slots[b] = slot;
+	heap->deadlines[b] = deadline;
+
+	heap->position[heap->slots[a]] = a;
+	heap->position[heap->slots[b]] = b;
+}
+
+void deadlineHeapSiftUp(deadlineHeapStruct *heap, uint8_t index) {
+	while (index > 0) {
+		uint8_t parent = (index - 1) / 2;
+
+		if (!deadlineBefore(heap->deadlines[index], heap->deadlines[parent]))
+			break;
+
+		deadlineHeapSwap(heap, index, parent);
+		index = parent;
+	}
+}
+
+void deadlineHeapSiftDown(deadlineHeapStruct *heap, uint8_t index) {
+	for (;;) {
+		uint8_t smallest = index;
+		uint8_t left = index * 2 + 1, right = index * 2 + 2;
+
+		if (left < heap->size && deadlineBefore(heap->deadlines[left], heap->deadlines[smallest]))
+			smallest = left;
+
+		if (right < heap->size && deadlineBefore(heap->deadlines[right], heap->deadlines[smallest]))
+			smallest = right;
+
+		if (smallest == index)
+			break;
+
+		deadlineHeapSwap(heap, index, smallest);
+		index = smallest;
+	}
+}
@@ -0,0 +1,50 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEADLINEHEAP_h
+#define DEADLINEHEAP_h
+
+#include <Arduino.h>
+
+#include "settings.h"
+
+#define DEADLINE_HEAP_CAPACITY ICMP_QUEUE_SIZE
+
+/**
+ * Binary min-heap of (slot, deadline) ordered by millis() deadline, each slot present at
+ * most once. Deadlines are compared wraparound-safe, so they must lie within ~24 days
+ * of each other. Not locked internally.
+ */
+struct deadlineHeapStruct {
+	uint8_t size;
+
+	uint8_t slots[DEADLINE_HEAP_CAPACITY];
+	unsigned long deadlines[DEADLINE_HEAP_CAPACITY];
+
+	int8_t position[DEADLINE_HEAP_CAPACITY];  // index in slots[] or -1
+};
+
+void deadlineHeapInit(deadlineHeapStruct *heap);
+void deadlineHeapSet(deadlineHeapStruct *heap, uint8_t slot, unsigned long deadline);
+void deadlineHeapRemove(deadlineHeapStruct *heap, uint8_t slot);
+bool deadlineHeapPeek(deadlineHeapStruct *heap, uint8_t *slot, unsigned long *deadline);
+
+bool deadlineBefore(unsigned long a, unsigned long b);
+bool deadlineReached(unsigned long deadline, unsigned long now);
+
+#endif
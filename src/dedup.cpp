@@ -0,0 +1,109 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dedup.h"
+
+#include "deadlineheap.h"
+
+struct dedupEntry {
+	bool used;
+	dedupKind kind;
+	uint32_t key;
+	unsigned long seenAt;
+	uint32_t order;  // dedupRecords when recorded, several records can share one millis()
+};
+
+dedupEntry dedupWindow[DEDUP_SIZE];
+uint32_t dedupRecords = 0;
+mqttPublishInfo dedupPublish;
+
+extern "C" lwmqtt_err_t __real_lwmqtt_decode_publish(uint8_t *buf, size_t buf_len, bool *dup, uint16_t *packet_id, lwmqtt_string_t *topic, lwmqtt_message_t *msg);
+extern "C" lwmqtt_err_t __wrap_lwmqtt_decode_publish(uint8_t *buf, size_t buf_len, bool *dup, uint16_t *packet_id, lwmqtt_string_t *topic, lwmqtt_message_t *msg);
+
+dedupEntry *dedupFind(dedupKind kind, uint32_t key);
+
+mqttPublishInfo dedupLastPublish() {
+	return dedupPublish;
+}
+
+bool dedupSeen(dedupKind kind, uint32_t key) {
+	return dedupFind(kind, key) != NULL;
+}
+
+// Refreshes an entry for the same key, otherwise takes an expired or the oldest one
+void dedupRecord(dedupKind kind, uint32_t key) {
+	dedupEntry *entry = dedupFind(kind, key);
+	unsigned long now = millis();
+
+	for (uint8_t i = 0; i < DEDUP_SIZE && entry == NULL; i++) {
+		if (!dedupWindow[i].used || deadlineReached(dedupWindow[i].seenAt + DEDUP_WINDOW_MS, now))
+			entry = &dedupWindow[i];
+	}
+
+	if (entry == NULL) {
+		dedupEntry *oldest = &dedupWindow[0];
+
+		for (uint8_t i = 1; i < DEDUP_SIZE; i++) {
+			if ((int32_t)(dedupWindow[i].order - oldest->order) < 0)
+				oldest = &dedupWindow[i];
+		}
+
+		entry = oldest;
+	}
+
+	entry->used = true;
+	entry->kind = kind;
+	entry->key = key;
+	entry->seenAt = now;
+	entry->order = dedupRecords++;
+}
+
+// FNV-1a
+uint32_t dedupHash(const char *data, size_t length) {
+	uint32_t hash = 2166136261UL;
+
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (uint8_t)data[i];
+		hash *= 16777619UL;
+	}
+
+	return hash;
+}
+
+dedupEntry *dedupFind(dedupKind kind, uint32_t key) {
+	unsigned long now = millis();
+
+	for (uint8_t i = 0; i < DEDUP_SIZE; i++) {
+		if (dedupWindow[i].used && dedupWindow[i].kind == kind && dedupWindow[i].key == key && !deadlineReached(dedupWindow[i].seenAt + DEDUP_WINDOW_MS, now))
+			return &dedupWindow[i];
+	}
+
+	return NULL;
+}
+
+lwmqtt_err_t __wrap_lwmqtt_decode_publish(uint8_t *buf, size_t buf_len, bool *dup, uint16_t *packet_id, lwmqtt_string_t *topic, lwmqtt_message_t *msg) {
+	lwmqtt_err_t err = __real_lwmqtt_decode_publish(buf, buf_len, dup, packet_id, topic, msg);
+
+	if (err == LWMQTT_SUCCESS) {
+		dedupPublish.packetId = *packet_id;
+		dedupPublish.dup = *dup;
+		dedupPublish.qos = msg->qos;
+	}
+
+	return err;
+}
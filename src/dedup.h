@@ -0,0 +1,52 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEDUP_h
+#define DEDUP_h
+
+#include <Arduino.h>
+#include <MQTT.h>
+
+#include "settings.h"
+
+enum dedupKind : uint8_t {
+	DEDUP_PACKET = 0,  // MQTT packet ID, only meaningful on redelivery (DUP set), IDs are reused once acknowledged
+	DEDUP_REQUEST = 1  // client supplied request ID, hashed
+};
+
+// Header fields of the PUBLISH being delivered, arduino-mqtt does not pass them to the callback
+struct mqttPublishInfo {
+	uint16_t packetId;
+	bool dup;
+	lwmqtt_qos_t qos;
+};
+
+/**
+ * Bounded window (DEDUP_SIZE entries, DEDUP_WINDOW_MS) of requests already run, so QoS 1
+ * redeliveries are acknowledged without running them again.
+ * Packet IDs come from a linker wrap of lwmqtt_decode_publish() (-Wl,--wrap=lwmqtt_decode_publish),
+ * which runs right before the message callback on the same task.
+ * Not locked: only used from the MQTT callback on the loop() task.
+ */
+mqttPublishInfo dedupLastPublish();
+
+bool dedupSeen(dedupKind kind, uint32_t key);
+void dedupRecord(dedupKind kind, uint32_t key);
+uint32_t dedupHash(const char *data, size_t length);
+
+#endif
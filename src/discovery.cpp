@@ -0,0 +1,118 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "discovery.h"
+
+#include "freertos/FreeRTOS.h"
+
+#include "deadlineheap.h"
+
+struct discoveryEntry {
+	uint8_t mac[MAC_ADDRESS_SIZE];
+	uint32_t ip;  // 0 when unused
+	unsigned long lastSeen;
+};
+
+// Written from the tcpip thread, so guarded by a spinlock rather than a mutex
+discoveryEntry discoveryTable[DISCOVERY_TABLE_SIZE];
+portMUX_TYPE discoveryMux = portMUX_INITIALIZER_UNLOCKED;
+
+volatile unsigned long discoveryDeferredAt = 0;
+volatile bool discoveryDeferSet = false;
+
+// Keeps one entry per MAC and per IP, the least recently seen host makes room when full
+void discoveryLearn(uint32_t ip, const uint8_t *mac) {
+	int8_t slot = -1;
+	uint8_t oldest = 0;
+	unsigned long now = millis();
+
+	if (ip == 0)
+		return;
+
+	portENTER_CRITICAL(&discoveryMux);
+
+	for (uint8_t i = 0; i < DISCOVERY_TABLE_SIZE; i++) {
+		discoveryEntry *entry = &discoveryTable[i];
+
+		if (entry->ip == 0) {
+			if (slot < 0)
+				slot = i;
+			continue;
+		}
+
+		if (memcmp(entry->mac, mac, MAC_ADDRESS_SIZE) == 0) {
+			slot = i;
+			break;
+		}
+
+		if (deadlineBefore(entry->lastSeen, discoveryTable[oldest].lastSeen) || discoveryTable[oldest].ip == 0)
+			oldest = i;
+	}
+
+	if (slot < 0)
+		slot = oldest;
+
+	// The IP moved to another MAC
+	for (uint8_t i = 0; i < DISCOVERY_TABLE_SIZE; i++) {
+		if (i != slot && discoveryTable[i].ip == ip)
+			discoveryTable[i].ip = 0;
+	}
+
+	memcpy(discoveryTable[slot].mac, mac, MAC_ADDRESS_SIZE);
+	discoveryTable[slot].ip = ip;
+	discoveryTable[slot].lastSeen = now;
+
+	portEXIT_CRITICAL(&discoveryMux);
+}
+
+bool discoveryLookup(const uint8_t *mac, uint32_t *ip) {
+	bool found = false;
+
+	portENTER_CRITICAL(&discoveryMux);
+	for (uint8_t i = 0; i < DISCOVERY_TABLE_SIZE && !found; i++) {
+		if (discoveryTable[i].ip != 0 && memcmp(discoveryTable[i].mac, mac, MAC_ADDRESS_SIZE) == 0) {
+			*ip = discoveryTable[i].ip;
+			found = true;
+		}
+	}
+	portEXIT_CRITICAL(&discoveryMux);
+
+	return found;
+}
+
+uint8_t discoveryCount() {
+	uint8_t count = 0;
+
+	portENTER_CRITICAL(&discoveryMux);
+	for (uint8_t i = 0; i < DISCOVERY_TABLE_SIZE; i++) {
+		if (discoveryTable[i].ip != 0)
+			count++;
+	}
+	portEXIT_CRITICAL(&discoveryMux);
+
+	return count;
+}
+
+void discoveryDefer() {
+	discoveryDeferredAt = millis();
+	discoveryDeferSet = true;
+}
+
+bool discoveryDeferred() {
+	return discoveryDeferSet && millis() - discoveryDeferredAt < DISCOVERY_DEFER_MS;
+}
@@ -0,0 +1,40 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DISCOVERY_h
+#define DISCOVERY_h
+
+#include <Arduino.h>
+
+#include "magicpacket.h"
+#include "settings.h"
+
+/**
+ * MAC -> IP table of local hosts, learned from every ARP frame the stack receives
+ * (see __wrap_etharp_input()) and filled in actively by discoverySweepTask().
+ * Lets wake/status requests leave out the IP, it is resolved when the status check runs.
+ */
+void discoveryLearn(uint32_t ip, const uint8_t *mac);
+bool discoveryLookup(const uint8_t *mac, uint32_t *ip);
+uint8_t discoveryCount();
+
+// Live wake traffic pushes the sweep back by DISCOVERY_DEFER_MS
+void discoveryDefer();
+bool discoveryDeferred();
+
+#endif
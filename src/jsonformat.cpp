@@ -0,0 +1,346 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "jsonformat.h"
+
+#include "wireformat.h"
+
+bool parseWakeMessage(JsonObject obj, wakeMessageStruct *device) {
+	memset(device, 0, sizeof(wakeMessageStruct));
+
+	if (!parseProbeMethod(obj["probe"], &device->probe))
+		return false;
+
+	if (obj["device"].is<int>()) {
+		deviceRecordStruct record;
+
+		if (!registryGet(obj["device"].as<int>(), &record))
+			return false;
+
+		memcpy(device->mac, record.mac, MAC_ADDRESS_SIZE);
+		device->port = record.port;
+
+		device->secureOn = record.secureOn;
+		memcpy(device->secureOnPassword, record.secureOnPassword, SECURE_ON_SIZE);
+
+		if (obj.containsKey("topic") && !copyTopic(device->topic, obj["topic"].as<const char *>()))
+			return false;
+		else if (!obj.containsKey("topic"))
+			strcpy(device->topic, record.topic);
+
+		device->ip = record.ip;
+		device->retrieveStatus = (obj["retrieveStatus"] | (record.ip != 0)) && device->topic[0] != '\0';
+
+		device->target = record.target;
+		return parseWakeTarget(obj, device->ip, &device->target);
+	}
+
+	if (!macFromString(obj["MAC"].as<const char *>(), device->mac))
+		return false;
+
+	device->port = obj.containsKey("port") ? obj["port"].as<uint16_t>() : 9;
+
+	// Without "ip" the address is resolved from the discovery table
+	if (obj.containsKey("ip") && !parseIP(obj["ip"].as<const char *>(), &device->ip))
+		return false;
+
+	if (obj.containsKey("retrieveStatus") && obj.containsKey("topic")) {
+		device->retrieveStatus = obj["retrieveStatus"].as<bool>();
+
+		if (!copyTopic(device->topic, obj["topic"].as<const char *>()))
+			return false;
+	}
+
+	if (!parseWakeTarget(obj, device->ip, &device->target))
+		return false;
+
+	if (obj.containsKey("secureOn") && obj.containsKey("secureOnPassword")) {
+		device->secureOn = obj["secureOn"].as<bool>();
+
+		if (device->secureOn && !macFromString(obj["secureOnPassword"].as<const char *>(), device->secureOnPassword))
+			return false;
+	}
+
+	return true;
+}
+
+bool parseStatusMessage(JsonObject obj, statusMessageStruct *status) {
+	memset(status, 0, sizeof(statusMessageStruct));
+
+	if (!parseProbeMethod(obj["probe"], &status->probe))
+		return false;
+
+	if (obj["device"].is<int>()) {
+		deviceRecordStruct record;
+
+		if (!registryGet(obj["device"].as<int>(), &record))
+			return false;
+
+		memcpy(status->mac, record.mac, MAC_ADDRESS_SIZE);
+		status->ip = record.ip;
+
+		return copyTopic(status->topic, obj["topic"] | (const char *)record.topic) && status->topic[0] != '\0';
+	}
+
+	if (!obj.containsKey("topic") || !obj.containsKey("device"))
+		return false;
+
+	if (!copyTopic(status->topic, obj["topic"].as<const char *>()))
+		return false;
+
+	if (!macFromString(obj["device"]["MAC"].as<const char *>(), status->mac))
+		return false;
+
+	return !obj["device"].containsKey("IP") || parseIP(obj["device"]["IP"].as<const char *>(), &status->ip);
+}
+
+bool parseWakeBatch(JsonObject obj, wakeBatchStruct *batch) {
+	JsonArray devices = obj["devices"].as<JsonArray>();
+
+	if (devices.isNull() || devices.size() == 0 || devices.size() > WAKE_BATCH_MAX)
+		return false;
+
+	memset(batch, 0, sizeof(wakeBatchStruct));
+
+	if (obj.containsKey("topic") && !copyTopic(batch->topic, obj["topic"].as<const char *>()))
+		return false;
+
+	const char *batchProbe = obj["probe"];
+
+	for (JsonVariant entry : devices) {
+		batchDeviceStruct *device = &batch->devices[batch->count];
+
+		if (!parseProbeMethod(entry["probe"] | batchProbe, &device->probe))
+			return false;
+
+		if (entry.is<int>()) {
+			deviceRecordStruct record;
+
+			if (!registryGet(entry.as<int>(), &record))
+				return false;
+
+			memcpy(device->mac, record.mac, MAC_ADDRESS_SIZE);
+			device->port = record.port;
+
+			device->secureOn = record.secureOn;
+			memcpy(device->secureOnPassword, record.secureOnPassword, SECURE_ON_SIZE);
+
+			device->ip = record.ip;
+			device->retrieveStatus = record.ip != 0 && batch->topic[0] != '\0';
+			device->target = record.target;
+
+			batch->count++;
+			continue;
+		}
+
+		if (!macFromString(entry["MAC"].as<const char *>(), device->mac))
+			return false;
+
+		device->port = entry.containsKey("port") ? entry["port"].as<uint16_t>() : 9;
+
+		device->secureOn = entry.containsKey("secureOnPassword");
+		if (device->secureOn && !macFromString(entry["secureOnPassword"].as<const char *>(), device->secureOnPassword))
+			return false;
+
+		device->retrieveStatus = (entry["retrieveStatus"] | entry.containsKey("ip")) && batch->topic[0] != '\0';
+		if (entry.containsKey("ip") && !parseIP(entry["ip"].as<const char *>(), &device->ip))
+			return false;
+
+		if (!parseWakeTarget(entry.as<JsonObject>(), device->ip, &device->target))
+			return false;
+
+		batch->count++;
+	}
+
+	return true;
+}
+
+bool parseDeviceRecord(JsonObject obj, deviceRecordStruct *record) {
+	memset(record, 0, sizeof(deviceRecordStruct));
+
+	if (!macFromString(obj["MAC"].as<const char *>(), record->mac))
+		return false;
+
+	record->port = obj["port"] | 9;
+
+	if (obj.containsKey("ip") && !parseIP(obj["ip"].as<const char *>(), &record->ip))
+		return false;
+
+	if (obj.containsKey("topic") && !copyTopic(record->topic, obj["topic"].as<const char *>()))
+		return false;
+
+	record->secureOn = obj.containsKey("secureOnPassword");
+	if (record->secureOn && !macFromString(obj["secureOnPassword"].as<const char *>(), record->secureOnPassword))
+		return false;
+
+	return parseWakeTarget(obj, record->ip, &record->target);
+}
+
+bool copyTopic(char *dest, const char *src) {
+	if (src == NULL || strlen(src) >= TOPIC_SIZE)
+		return false;
+
+	strcpy(dest, src);
+	return true;
+}
+
+// A missing method falls back to PROBE_DEFAULT
+bool parseProbeMethod(const char *name, probeMethod *method) {
+	if (name == NULL)
+		*method = PROBE_DEFAULT;
+	else if (strcmp(name, "icmp") == 0)
+		*method = PROBE_ICMP;
+	else if (strcmp(name, "arp") == 0)
+		*method = PROBE_ARP;
+	else if (strcmp(name, "auto") == 0)
+		*method = PROBE_AUTO;
+	else
+		return false;
+
+	return true;
+}
+
+const char *probeMethodName(probeMethod method) {
+	switch (method) {
+		case PROBE_ARP:
+			return "arp";
+		case PROBE_AUTO:
+			return "auto";
+		case PROBE_ANNOUNCE:
+			return "announce";
+		case PROBE_BUSY:
+			return "busy";
+		default:
+			return "icmp";
+	}
+}
+
+bool parseIP(const char *ipString, uint32_t *ip) {
+	IPAddress address;
+
+	if (ipString == NULL || !address.fromString(ipString))
+		return false;
+
+	*ip = address;
+	return true;
+}
+
+// "subnet": "10.0.20.0/24" wakes through a directed broadcast there, "unicast": true sends to
+// ip (or the discovered address) instead of broadcasting. Without either, target is left as given
+bool parseWakeTarget(JsonObject obj, uint32_t ip, wakeTargetStruct *target) {
+	bool unicast = obj["unicast"] | false;
+
+	if (obj.containsKey("subnet")) {
+		target->delivery = DELIVER_DIRECTED;
+		return !unicast && parseSubnetBroadcast(obj["subnet"].as<const char *>(), &target->address);
+	}
+
+	if (unicast) {
+		target->delivery = DELIVER_UNICAST;
+		target->address = ip;
+	}
+
+	return true;
+}
+
+// "a.b.c.d/prefix" -> broadcast address of that subnet, /31 and /32 have none
+bool parseSubnetBroadcast(const char *subnet, uint32_t *broadcast) {
+	char address[16];
+	const char *slash;
+	uint32_t network;
+	int prefix;
+
+	if (subnet == NULL || (slash = strchr(subnet, '/')) == NULL || (size_t)(slash - subnet) >= sizeof(address))
+		return false;
+
+	memcpy(address, subnet, slash - subnet);
+	address[slash - subnet] = '\0';
+	prefix = atoi(slash + 1);
+
+	if (prefix < 1 || prefix > 30 || !parseIP(address, &network))
+		return false;
+
+	uint32_t mask = 0xFFFFFFFF << (32 - prefix);
+	IPAddress base(network), netmask(mask >> 24, (mask >> 16) & 0xFF, (mask >> 8) & 0xFF, mask & 0xFF), result;
+
+	for (uint8_t i = 0; i < 4; i++)
+		result[i] = base[i] | ~netmask[i];
+
+	*broadcast = result;
+	return true;
+}
+
+// A single result keeps the original {MAC, pingResult} object, several become an array of them.
+// Binary requests get the WIRE_STATUS_REPLY encoding instead. Results that would not fit in size
+// stay in the batch for the next call. Returns the payload length,
+// traceIds (STATUS_COALESCE_MAX) receives the requests it answers
+size_t statusCoalesceSerialize(statusCoalesceStruct *batch, char *data, size_t size, uint16_t *traceIds, uint8_t *traceCount) {
+	size_t length;
+	uint8_t taken;
+
+	if (batch->format == FORMAT_BINARY) {
+		taken = batch->count;
+		length = wireEncodeStatus(batch->results, taken, (uint8_t *)data, size);
+	} else {
+		StaticJsonDocument<JSON_ARRAY_SIZE(STATUS_COALESCE_MAX) + STATUS_COALESCE_MAX * JSON_OBJECT_SIZE(5)> jsonBuffer;
+		JsonArray rootArray = jsonBuffer.to<JsonArray>();
+		char macStrings[STATUS_COALESCE_MAX][MAC_STRING_SIZE];
+		size_t arrayLength = 2;  // brackets
+
+		for (taken = 0; taken < batch->count; taken++) {
+			statusResultStruct *result = &batch->results[taken];
+			JsonObject resultJSON = rootArray.createNestedObject();
+
+			macToString(result->mac, macStrings[taken]);
+
+			resultJSON["MAC"] = (const char *)macStrings[taken];
+			resultJSON["pingResult"] = result->status;
+			if (!result->status && result->method == PROBE_BUSY)
+				resultJSON["error"] = "busy";
+			else if (result->status) {
+				resultJSON["method"] = probeMethodName(result->method);
+				resultJSON["rtt"] = result->rttMicros / 1000.0;  // ms
+				resultJSON["elapsed"] = result->elapsedMillis;   // ms
+			}
+
+			// serializeJson() truncates silently, so stop while the terminator still fits
+			size_t elementLength = measureJson(resultJSON) + (taken > 0 ? 1 : 0);
+			if (taken > 0 && arrayLength + elementLength >= size) {
+				rootArray.remove(taken);
+				break;
+			}
+
+			arrayLength += elementLength;
+		}
+
+		if (taken == 1)
+			length = serializeJson(rootArray[0], data, size);
+		else
+			length = serializeJson(rootArray, data, size);
+	}
+
+	for (uint8_t i = 0; i < taken; i++)
+		traceIds[i] = batch->results[i].traceId;
+
+	*traceCount = taken;
+
+	batch->count -= taken;
+	memmove(batch->results, batch->results + taken, batch->count * sizeof(statusResultStruct));
+
+	return length;
+}
@@ -0,0 +1,48 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef JSONFORMAT_h
+#define JSONFORMAT_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include "messages.h"
+#include "registry.h"
+#include "settings.h"
+
+/**
+ * JSON requests on AWS_WAKE_CHANNEL decoded into the same structs as wireformat.h.
+ * A "device" ID is looked up in the registry, strings are copied out of the document.
+ * Pure apart from the registry lookup, so they also build in the native environment.
+ */
+bool parseWakeMessage(JsonObject obj, struct wakeMessageStruct *device);
+bool parseStatusMessage(JsonObject obj, struct statusMessageStruct *status);
+bool parseWakeBatch(JsonObject obj, struct wakeBatchStruct *batch);
+bool parseDeviceRecord(JsonObject obj, deviceRecordStruct *record);
+
+bool copyTopic(char *dest, const char *src);
+bool parseIP(const char *ipString, uint32_t *ip);
+bool parseWakeTarget(JsonObject obj, uint32_t ip, wakeTargetStruct *target);
+bool parseSubnetBroadcast(const char *subnet, uint32_t *broadcast);
+bool parseProbeMethod(const char *name, probeMethod *method);
+const char *probeMethodName(probeMethod method);
+
+size_t statusCoalesceSerialize(struct statusCoalesceStruct *batch, char *data, size_t size, uint16_t *traceIds, uint8_t *traceCount);
+
+#endif
@@ -0,0 +1,121 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "logger.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Bounded MPSC ring: a slot is free for the producer at position p when its sequence equals p,
+// and holds a record for the consumer at position p when its sequence equals p + 1
+struct logSlot {
+	volatile uint32_t sequence;
+	logRecord record;
+};
+
+logSlot logRing[LOG_RING_SIZE];
+
+volatile uint32_t logHead = 0;  // next position to claim, shared by producers
+uint32_t logTail = 0;           // next position to drain, logTask() only
+
+volatile uint32_t logDropCount = 0;
+
+#define LOG_TEXT_MARKER UINTPTR_MAX
+
+void logBegin() {
+	static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of two");
+	static_assert(LOG_MAX_ARGS == 6, "logTask() passes six arguments to snprintf()");
+
+	for (uint32_t i = 0; i < LOG_RING_SIZE; i++)
+		logRing[i].sequence = i;
+}
+
+void logPush(const logRecord *record) {
+	uint32_t position = __atomic_load_n(&logHead, __ATOMIC_RELAXED);
+	logSlot *slot;
+
+	for (;;) {
+		slot = &logRing[position & (LOG_RING_SIZE - 1)];
+		int32_t difference = (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - position);
+
+		if (difference == 0) {
+			if (__atomic_compare_exchange_n(&logHead, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (difference < 0) {
+			__atomic_fetch_add(&logDropCount, 1, __ATOMIC_RELAXED);
+			return;
+		} else
+			position = __atomic_load_n(&logHead, __ATOMIC_RELAXED);
+	}
+
+	slot->record = *record;
+	__atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t logDropped() {
+	return __atomic_load_n(&logDropCount, __ATOMIC_RELAXED);
+}
+
+uintptr_t logArg(logRecord *record, logTextArg value) {
+	size_t length = min(value.length, (size_t)LOG_TEXT_SIZE - 1);
+
+	if (value.text == NULL)
+		length = 0;
+	else
+		length = strnlen(value.text, length);
+
+	memcpy(record->text, value.text, length);
+	record->text[length] = '\0';
+
+	return LOG_TEXT_MARKER;
+}
+
+void logTask(void *pvParameters) {
+	const char levels[] = "?EWID";
+	char line[LOG_LINE_SIZE];
+	uint32_t reportedDrops = 0;
+
+	for (;;) {
+		logSlot *slot = &logRing[logTail & (LOG_RING_SIZE - 1)];
+
+		if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != logTail + 1) {
+			uint32_t drops = logDropped();
+
+			if (drops != reportedDrops) {
+				Serial.printf("log: %u records dropped\n", drops - reportedDrops);
+				reportedDrops = drops;
+			}
+
+			vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_MS));
+			continue;
+		}
+
+		logRecord *record = &slot->record;
+		uintptr_t args[LOG_MAX_ARGS];
+
+		for (uint8_t i = 0; i < LOG_MAX_ARGS; i++)
+			args[i] = record->args[i] == LOG_TEXT_MARKER ? (uintptr_t)record->text : record->args[i];
+
+		snprintf(line, sizeof(line), record->format, args[0], args[1], args[2], args[3], args[4], args[5]);
+		Serial.printf("%lu %c ", record->millis, levels[record->level <= LOG_DEBUG ? record->level : 0]);
+		Serial.println(line);
+
+		__atomic_store_n(&slot->sequence, logTail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+		logTail++;
+	}
+}
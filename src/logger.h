@@ -0,0 +1,113 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOGGER_h
+#define LOGGER_h
+
+#include <Arduino.h>
+
+#include "settings.h"
+
+#define LOG_ERROR 1
+#define LOG_WARN 2
+#define LOG_INFO 3
+#define LOG_DEBUG 4
+
+/**
+ * Non-blocking logger for hot paths. A record keeps the format pointer and raw arguments,
+ * formatting and Serial output happen later in logTask(). Producers claim ring slots with
+ * a compare-and-swap, a full ring drops the record and counts it, nothing ever waits.
+ *
+ * Because formatting is deferred, arguments must be integers, pointers to static strings,
+ * or logText() for a string that does not outlive the call (copied, one per record).
+ * Use LOG_IP() for addresses. A newline is added to every record.
+ * Levels above LOG_LEVEL compile to nothing.
+ */
+struct logTextArg {
+	const char *text;
+	size_t length;
+};
+
+inline logTextArg logText(const char *text, size_t length = SIZE_MAX) {
+	logTextArg arg = {text, length};
+	return arg;
+}
+
+#define LOG_IP(ip) (ip)[0], (ip)[1], (ip)[2], (ip)[3]
+
+struct logRecord {
+	unsigned long millis;
+	const char *format;
+	uintptr_t args[LOG_MAX_ARGS];
+	uint8_t level;
+	char text[LOG_TEXT_SIZE];
+};
+
+void logBegin();
+void logPush(const logRecord *record);
+uint32_t logDropped();
+void logTask(void *pvParameters);
+
+template <typename T>
+uintptr_t logArg(logRecord *record, T value) {
+	return (uintptr_t)value;
+}
+
+uintptr_t logArg(logRecord *record, logTextArg value);
+
+template <typename... Args>
+void logDeferred(uint8_t level, const char *format, Args... args) {
+	static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+
+	logRecord record;
+	record.millis = millis();
+	record.format = format;
+	record.level = level;
+	record.text[0] = '\0';
+
+	uintptr_t values[] = {logArg(&record, args)..., 0};
+	memcpy(record.args, values, sizeof...(Args) * sizeof(uintptr_t));
+
+	logPush(&record);
+}
+
+#if defined(PRINT_TO_SERIAL) && LOG_LEVEL >= LOG_ERROR
+#define Lerror(...) logDeferred(LOG_ERROR, __VA_ARGS__)
+#else
+#define Lerror(...)
+#endif
+
+#if defined(PRINT_TO_SERIAL) && LOG_LEVEL >= LOG_WARN
+#define Lwarn(...) logDeferred(LOG_WARN, __VA_ARGS__)
+#else
+#define Lwarn(...)
+#endif
+
+#if defined(PRINT_TO_SERIAL) && LOG_LEVEL >= LOG_INFO
+#define Linfo(...) logDeferred(LOG_INFO, __VA_ARGS__)
+#else
+#define Linfo(...)
+#endif
+
+#if defined(PRINT_TO_SERIAL) && LOG_LEVEL >= LOG_DEBUG
+#define Ldebug(...) logDeferred(LOG_DEBUG, __VA_ARGS__)
+#else
+#define Ldebug(...)
+#endif
+
+#endif
@@ -0,0 +1,140 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "magicpacket.h"
+
+int8_t hexValue(char c);
+
+magicPacketCacheEntry magicPacketCache[MAGIC_PACKET_CACHE_SIZE];
+magicPacketCacheStats cacheStats = {0, 0, 0};
+uint32_t cacheClock = 0;
+
+// Accepts 12 hex digits, optionally separated by ':', '-' or '.' (also used for SecureOn passwords)
+bool macFromString(const char *macString, uint8_t *mac) {
+	uint8_t digits = 0;
+
+	if (macString == NULL)
+		return false;
+
+	for (const char *c = macString; *c != '\0'; c++) {
+		if (*c == ':' || *c == '-' || *c == '.')
+			continue;
+
+		int8_t value = hexValue(*c);
+		if (value < 0 || digits == MAC_ADDRESS_SIZE * 2)
+			return false;
+
+		if (digits % 2 == 0)
+			mac[digits / 2] = value << 4;
+		else
+			mac[digits / 2] |= value;
+
+		digits++;
+	}
+
+	return digits == MAC_ADDRESS_SIZE * 2;
+}
+
+void macToString(const uint8_t *mac, char *macString) {
+	static const char hexDigits[] = "0123456789ABCDEF";
+
+	for (uint8_t i = 0; i < MAC_ADDRESS_SIZE; i++) {
+		macString[i * 3] = hexDigits[mac[i] >> 4];
+		macString[i * 3 + 1] = hexDigits[mac[i] & 0x0F];
+		macString[i * 3 + 2] = (i == MAC_ADDRESS_SIZE - 1) ? '\0' : ':';
+	}
+}
+
+size_t buildMagicPacket(uint8_t *packet, const uint8_t *mac, const uint8_t *secureOn) {
+	memset(packet, 0xFF, 6);
+
+	for (uint8_t i = 0; i < 16; i++)
+		memcpy(packet + 6 + (i * MAC_ADDRESS_SIZE), mac, MAC_ADDRESS_SIZE);
+
+	if (secureOn == NULL)
+		return MAGIC_PACKET_SIZE;
+
+	memcpy(packet + MAGIC_PACKET_SIZE, secureOn, SECURE_ON_SIZE);
+	return SECURE_MAGIC_PACKET_SIZE;
+}
+
+const uint8_t *magicPacketCacheGet(const uint8_t *mac, const uint8_t *secureOn, size_t *size) {
+	magicPacketCacheEntry *victim = &magicPacketCache[0];
+
+	for (uint8_t i = 0; i < MAGIC_PACKET_CACHE_SIZE; i++) {
+		magicPacketCacheEntry *entry = &magicPacketCache[i];
+
+		if (!entry->valid) {
+			if (victim->valid)
+				victim = entry;
+			continue;
+		}
+
+		if (memcmp(entry->mac, mac, MAC_ADDRESS_SIZE) == 0 && entry->secureOn == (secureOn != NULL) &&
+			(secureOn == NULL || memcmp(entry->secureOnPassword, secureOn, SECURE_ON_SIZE) == 0)) {
+			entry->lastUsed = ++cacheClock;
+			cacheStats.hits++;
+
+			*size = entry->size;
+			return entry->packet;
+		}
+
+		if (victim->valid && entry->lastUsed < victim->lastUsed)
+			victim = entry;
+	}
+
+	cacheStats.misses++;
+	if (victim->valid)
+		cacheStats.evictions++;
+
+	victim->valid = true;
+	victim->secureOn = (secureOn != NULL);
+
+	memcpy(victim->mac, mac, MAC_ADDRESS_SIZE);
+	if (secureOn != NULL)
+		memcpy(victim->secureOnPassword, secureOn, SECURE_ON_SIZE);
+
+	victim->size = buildMagicPacket(victim->packet, mac, secureOn);
+	victim->lastUsed = ++cacheClock;
+
+	*size = victim->size;
+	return victim->packet;
+}
+
+// Drop one device (e.g. its SecureOn password changed) or everything when mac is NULL
+void magicPacketCacheInvalidate(const uint8_t *mac) {
+	for (uint8_t i = 0; i < MAGIC_PACKET_CACHE_SIZE; i++) {
+		if (mac == NULL || memcmp(magicPacketCache[i].mac, mac, MAC_ADDRESS_SIZE) == 0)
+			magicPacketCache[i].valid = false;
+	}
+}
+
+magicPacketCacheStats magicPacketCacheGetStats() {
+	return cacheStats;
+}
+
+int8_t hexValue(char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
@@ -0,0 +1,64 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAGICPACKET_h
+#define MAGICPACKET_h
+
+#include <Arduino.h>
+
+#include "settings.h"
+
+#define MAC_ADDRESS_SIZE 6
+#define SECURE_ON_SIZE 6
+#define MAC_STRING_SIZE 18  // "AA:BB:CC:DD:EE:FF" + terminator
+
+#define MAGIC_PACKET_SIZE 102  // 6 * 0xFF + 16 * MAC
+#define SECURE_MAGIC_PACKET_SIZE 108  // MAGIC_PACKET_SIZE + SecureOn password
+
+bool macFromString(const char *macString, uint8_t *mac);
+void macToString(const uint8_t *mac, char *macString);
+size_t buildMagicPacket(uint8_t *packet, const uint8_t *mac, const uint8_t *secureOn = NULL);
+
+struct magicPacketCacheEntry {
+	bool valid;
+	bool secureOn;
+
+	uint8_t mac[MAC_ADDRESS_SIZE];
+	uint8_t secureOnPassword[SECURE_ON_SIZE];
+
+	uint8_t packet[SECURE_MAGIC_PACKET_SIZE];
+	uint8_t size;
+
+	uint32_t lastUsed;
+};
+
+struct magicPacketCacheStats {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t evictions;
+};
+
+/**
+ * Cache is not locked internally, callers serialize access (main.cpp holds udpSemaphore).
+ * Returned packet stays valid until the next cache call.
+ */
+const uint8_t *magicPacketCacheGet(const uint8_t *mac, const uint8_t *secureOn, size_t *size);
+void magicPacketCacheInvalidate(const uint8_t *mac = NULL);
+magicPacketCacheStats magicPacketCacheGetStats();
+
+#endif
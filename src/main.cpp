@@ -24,6 +24,13 @@ void setup() {
 	Sprintln("Booting\n");
 #endif
 
+	loopTaskHandler = xTaskGetCurrentTaskHandle();
+
+	logBegin();
+#ifdef PRINT_TO_SERIAL
+	xTaskCreate(logTask, "LOG_TASK", 3072, NULL, tskIDLE_PRIORITY, NULL);
+#endif
+
 #ifdef ENABLE_LED
 	setupLED(LED_BUILTIN);
 	ledOn();
@@ -38,46 +45,93 @@ void setup() {
 	net.setCertificate(clientCert);
 	net.setPrivateKey(privKey);
 
+#if defined(TLS_SESSION_RESUME)
+	tlsSessionBegin(AWS_HOST);
+#endif
+
 	client.begin(AWS_HOST, AWS_PORT, net);
-	client.onMessage(messageReceived);
+	client.setCleanSession(MQTT_CLEAN_SESSION);
+	client.onMessageAdvanced(messageReceived);
+
+	registryBegin();
+
+#if defined(SCHEDULED_WAKES)
+	scheduleBegin();
+#endif
 
-	WOL.setRepeat(REPEAT_MAGIC_PACKET, REPEAT_MAGIC_PACKET_DELAY_MS);
+#if defined(BOOT_MODEL)
+	bootModelBegin();
+#endif
 
 	setupTasks();
 }
 
 void loop() {
-	if (WiFi.isConnected()) {
-		if (client.connected()) {
-			client.loop();
+	statusCoalesceFlush(false);
 
-			mqttMessageQueueProcess();
-		} else {
-#ifdef ENABLE_LED
-#ifdef BLINK_LED
-			ledBlink(false);
-#endif
-			ledOn();
+	mqttConnectionProcess();
 
-#endif
-			if (time(nullptr) > BUILD_TIMESTAMP && timeSet == true)
-				connectToAWS();
-		}
-	}
+	if (mqttConnection.state == MQTT_CONNECTED)
+		mqttMessageQueueProcess();
 }
 
 void setupTasks() {
 	mqttQueueSemaphore = xSemaphoreCreateMutex();
 	icmpQueueSemaphore = xSemaphoreCreateMutex();
+	udpSemaphore = xSemaphoreCreateMutex();
+	statusCoalesceSemaphore = xSemaphoreCreateMutex();
+
+	xTaskCreate(ntpTask, "NTP_TASK", 2048, NULL, tskIDLE_PRIORITY, &ntpTaskHandler);
 
-	xTaskCreate(ntpTask, "NTP_TASK", 2048, NULL, tskIDLE_PRIORITY, NULL);
+#if defined(HEALTH_METRICS)
+	xTaskCreate(healthTask, "HEALTH_TASK", 3072, NULL, tskIDLE_PRIORITY, NULL);
+#endif
 
 #if defined(SCHEDULE_RESTART)
 	xTaskCreate(restartTask, "RESTART_TASK", 2048, NULL, tskIDLE_PRIORITY, NULL);
 #endif
 
+	deadlineHeapInit(&icmpSchedule);
+
+	pingEngineOpen();
+
 	xTaskCreatePinnedToCore(icmpTask, "ICMP_TASK", 4096, NULL, 6, &icmpTaskHandler, 1);
-	vTaskSuspend(icmpTaskHandler);
+	xTaskCreatePinnedToCore(icmpReceiveTask, "ICMP_RX_TASK", 2048, NULL, 6, &icmpReceiveTaskHandler, 1);
+
+	arpProbeBegin(icmpTaskHandler);
+
+#if defined(ANNOUNCE_LISTEN)
+	if (!announceBegin(icmpTaskHandler))
+		Lwarn("DHCP listener failed");
+#endif
+
+#if defined(DISCOVERY_SWEEP)
+	xTaskCreatePinnedToCore(discoverySweepTask, "DISCOVERY_TASK", 2048, NULL, tskIDLE_PRIORITY + 1, &discoveryTaskHandler, 1);
+#endif
+
+#if defined(SCHEDULED_WAKES)
+	xTaskCreate(scheduleTask, "SCHEDULE_TASK", 4096, NULL, tskIDLE_PRIORITY + 1, &scheduleTaskHandler);
+#endif
+
+#if defined(WORKER_POOL)
+	jobQueue = xQueueCreate(WORKER_JOB_SLOTS, sizeof(jobStruct));
+
+	wakeBatchFreeQueue = xQueueCreate(WAKE_BATCH_SLOTS, sizeof(uint8_t));
+
+	for (uint8_t i = 0; i < WAKE_BATCH_SLOTS; i++)
+		xQueueSend(wakeBatchFreeQueue, &i, 0);
+
+	for (uint8_t i = 0; i < WORKER_POOL_SIZE; i++)
+		xTaskCreatePinnedToCore(workerTask, "WORKER_TASK", WORKER_STACK_SIZE, NULL, 5, &workerTaskHandlers[i], 1);
+#endif
+
+#if defined(WAKE_SCHEDULER)
+	wakeSchedulerBegin();
+
+	xTaskCreatePinnedToCore(wakeSchedulerTask, "WAKE_SCHED_TASK", WORKER_STACK_SIZE, NULL, 5, &wakeSchedulerTaskHandler, 1);
+#endif
+
+	dispatchStats.baselineFreeHeap = ESP.getFreeHeap();
 }
 
 void wifiConnect() {
@@ -129,7 +183,7 @@ void wifiAcquiredIP(system_event_id_t event) {
 	Sprintln(" | IPv4: " + localIP.toString());
 #endif
 
-	WOL.calculateBroadcastAddress(WiFi.localIP(), WiFi.subnetMask());
+	broadcastAddress = getBroadcastAddress(WiFi.localIP(), WiFi.subnetMask());
 	updateSystemTime();
 }
 
@@ -142,6 +196,11 @@ void wifiDisconnected(system_event_id_t event) {
 #endif
 
 	Sprintln("STA disconnect detected");
+
+	portENTER_CRITICAL(&healthStatsMux);
+	healthStats.wifiDisconnects++;
+	portEXIT_CRITICAL(&healthStatsMux);
+
 	WiFi.reconnect();
 }
 
@@ -163,377 +222,1987 @@ void updateSystemTime() {
 		updateSystemTime();
 }
 
+// One step per loop() pass. Nothing waits for the next attempt, so the MQTT queue, status
+// coalescing and everything else in loop() keep running through an outage.
+// client.connect() itself still blocks for the TCP/TLS handshake of a single attempt
+void mqttConnectionProcess() {
+	if (mqttConnection.state == MQTT_CONNECTED) {
+		client.loop();
+
+		if (client.connected())
+			return;
+
+		Sprintln("AWS connection lost");
+
+		portENTER_CRITICAL(&mqttConnectionMux);
+		mqttConnection.lostAt = millis();
+		mqttConnection.failures = 0;
+		mqttConnection.nextAttempt = mqttConnection.lostAt;
+		portEXIT_CRITICAL(&mqttConnectionMux);
+
+		mqttConnectionSet(MQTT_WAITING);
+	}
+
+	// TLS needs a network and a valid clock
+	if (!WiFi.isConnected() || time(nullptr) <= BUILD_TIMESTAMP || timeSet == false) {
+		if (mqttConnection.state != MQTT_WAITING)
+			mqttConnectionSet(MQTT_WAITING);
+		return;
+	}
+
+	if (deadlineReached(mqttConnection.nextAttempt, millis()))
+		connectToAWS();
+}
+
+// A single attempt, a failure schedules the next one with jittered exponential backoff
 void connectToAWS() {
 	Sprint("AWS connecting ");
-	while (!client.connected()) {
-		if (client.connect(THING_NAME)) {
-			Sprintln("connected!");
 
-			if (!client.subscribe(AWS_WAKE_CHANNEL))
-				lwMQTTErr(client.lastError());
+	if (client.connect(THING_NAME)) {
+		Sprintln("connected!");
+
+#if defined(TLS_SESSION_RESUME)
+		tlsSessionStats tls = tlsSessionGetStats();
+		Linfo("tls: handshake %ums | resumed %u/%u", tls.lastMillis, tls.resumed, tls.handshakes);
+#endif
+
+		portENTER_CRITICAL(&healthStatsMux);
+		healthStats.mqttConnects++;
+		portEXIT_CRITICAL(&healthStatsMux);
+
+		portENTER_CRITICAL(&mqttConnectionMux);
+		mqttConnection.failures = 0;
+		mqttConnection.lastReconnectMillis = millis() - mqttConnection.lostAt;
+		if (mqttConnection.lastReconnectMillis > mqttConnection.maxReconnectMillis)
+			mqttConnection.maxReconnectMillis = mqttConnection.lastReconnectMillis;
+		portEXIT_CRITICAL(&mqttConnectionMux);
+
+		mqttConnectionSet(MQTT_CONNECTED);
+
+		Linfo("mqtt: session present %d", client.sessionPresent());
+
+		if (!client.subscribe(AWS_WAKE_CHANNEL, MQTT_SUB_QOS) || !client.subscribe(AWS_WAKE_CHANNEL_BINARY, MQTT_SUB_QOS))
+			lwMQTTErr(client.lastError());
 #ifdef ENABLE_LED
-			else {
-				ledOff();
+		else {
+			ledOff();
 #ifdef BLINK_LED
-				ledBlink(true);
+			ledBlink(true);
 #endif
-			}
+		}
 #endif
+	} else {
+		uint32_t backoff = mqttBackoff(mqttConnection.failures, MQTT_RECONNECT_BASE_MS, MQTT_RECONNECT_MAX_MS);
 
-		} else {
-			Sprint("failed, reason -> ");
-			lwMQTTErrConnection(client.returnCode());
+		Sprint("failed, reason -> ");
+		lwMQTTErrConnection(client.returnCode());
 
-			Sprint(" < try again in ");
-			Sprint(RETRY_CONN_AWS_SEC);
-			Sprintln(" seconds");
+		Sprint(" < try again in ");
+		Sprint(backoff);
+		Sprintln(" ms");
 
-			vTaskDelay(pdMS_TO_TICKS(RETRY_CONN_AWS_SEC * 1000));
-		}
+		portENTER_CRITICAL(&mqttConnectionMux);
+		if (mqttConnection.failures < UINT8_MAX)
+			mqttConnection.failures++;
+		mqttConnection.lastReturnCode = client.returnCode();
+		mqttConnection.nextAttempt = millis() + backoff;
+		portEXIT_CRITICAL(&mqttConnectionMux);
+
+		mqttConnectionSet(MQTT_BACKOFF);
 	}
 }
 
-void messageReceived(String &topic, String &payload) {
-	Sprintln("Recieved [" + topic + "]: " + payload);
+void mqttConnectionSet(mqttConnState state) {
+	if (state != mqttConnection.state)
+		Linfo("mqtt: %s -> %s", mqttConnStateName(mqttConnection.state), mqttConnStateName(state));
 
-	if (strcmp(topic.c_str(), AWS_WAKE_CHANNEL) == 0) {
-		DynamicJsonDocument doc(2048);
-		DeserializationError error = deserializeJson(doc, payload.c_str(), 2048);
-		JsonObject obj = doc.as<JsonObject>();
+	portENTER_CRITICAL(&mqttConnectionMux);
+	mqttConnection.state = state;
+	mqttConnection.since = millis();
+	portEXIT_CRITICAL(&mqttConnectionMux);
 
-		if (error) {
-			Sprint("deserializeJson() failed: ");
-			Sprintln(error.c_str());
-			return;
-		}
+#ifdef ENABLE_LED
+	if (state != MQTT_CONNECTED) {
+#ifdef BLINK_LED
+		ledBlink(false);
+#endif
+		ledOn();
+	}
+#endif
+}
 
-		if (!obj.containsKey("id")) {
-			Sprint("Failed: no msg id");
-			return;
-		}
-		const int msgID = obj["id"].as<int>();
+const char *mqttConnStateName(mqttConnState state) {
+	switch (state) {
+		case MQTT_CONNECTED:
+			return "connected";
+		case MQTT_BACKOFF:
+			return "backoff";
+		default:
+			return "waiting";
+	}
+}
+
+void messageReceived(MQTTClient *mqttClient, char topic[], char bytes[], int length) {
+	const unsigned long receivedMicros = micros();
+	bool taken = true;  // false when the job pool or batch slots were full
 
-		switch (msgID) {
-			case 1: {
-				if (obj.containsKey("MAC")) {
-					wakeMessageStruct *device = new wakeMessageStruct;
+	// Acknowledged by arduino-mqtt once this returns
+	if (messageDuplicate())
+		return;
+
+#if defined(TRACE_PARSE_ALLOCATIONS)
+	allocTraceBegin();
+#endif
+
+	Linfo("Recieved [%s] %d bytes", logText(topic), length);
 
-					device->mac = obj["MAC"].as<String>();
+	if (strcmp(topic, AWS_WAKE_CHANNEL_BINARY) == 0) {
+		taken = binaryMessageReceived((const uint8_t *)bytes, length, receivedMicros);
+	} else if (strcmp(topic, AWS_WAKE_CHANNEL) == 0) {
+		Ldebug("payload %s", logText(bytes, length));
 
-					if (obj.containsKey("port"))
-						device->port = obj["port"].as<uint16_t>();
+		// Zero-copy: strings in messageDoc point into the MQTT buffer, copied out below
+		DeserializationError error = deserializeJson(messageDoc, bytes, length);
+		JsonObject obj = messageDoc.as<JsonObject>();
 
-					if (obj.containsKey("retrieveStatus") && obj.containsKey("topic") && obj.containsKey("ip")) {
-						device->retrieveStatus = obj["retrieveStatus"].as<bool>();
-						device->topic = obj["topic"].as<String>();
-						device->ip = obj["ip"].as<String>();
+		if (error) {
+			Lwarn("deserializeJson() failed: %s", error.c_str());
+		} else if (!obj.containsKey("id")) {
+			Lwarn("Failed: no msg id");
+		} else if (requestDuplicate(obj["rid"])) {
+			Linfo("Duplicate request skipped");
+		} else {
+			const int msgID = obj["id"].as<int>();
+
+			jobStruct job;
+			job.receivedMicros = receivedMicros;
+
+			switch (msgID) {
+				case 1: {
+					job.type = JOB_WAKE;
+
+					if (parseWakeMessage(obj, &job.wake))
+						taken = dispatchJob(job);
+					else
+						Lwarn("Failed: invalid wake message");
+				} break;
+				case 2: {
+					job.type = JOB_STATUS;
+
+					if (parseStatusMessage(obj, &job.status))
+						taken = dispatchJob(job);
+					else
+						Lwarn("Failed: invalid status message");
+				} break;
+				case 3: {
+					job.type = JOB_WAKE_BATCH;
+					job.batch = wakeBatchAcquire();
+
+					if (job.batch == NULL) {
+						taken = false;
+						break;
 					}
 
-					if (obj.containsKey("secureOn") && obj.containsKey("secureOnPassword")) {
-						device->secureOn = obj["secureOn"].as<bool>();
-						device->secureOnPassword = obj["secureOnPassword"].as<String>();
+					if (parseWakeBatch(obj, job.batch))
+						taken = dispatchJob(job);
+					else {
+						Lwarn("Failed: invalid batch wake");
+						wakeBatchRelease(job.batch);
 					}
+				} break;
+				case 4: {
+					uint8_t mac[MAC_ADDRESS_SIZE];
+					bool single = macFromString(obj["MAC"].as<const char *>(), mac);
+
+					xSemaphoreTake(udpSemaphore, portMAX_DELAY);
+					magicPacketCacheInvalidate(single ? mac : NULL);
+					xSemaphoreGive(udpSemaphore);
+
+					Linfo("Magic packet cache invalidated");
+				} break;
+				case 5: {
+					registryCommand(obj);
+				} break;
+				case 6: {
+					latencyMetricsPublish(obj["reset"] | false);
+				} break;
+#if defined(SCHEDULED_WAKES)
+				case 8: {
+					scheduleCommand(obj);
+				} break;
+#endif
+				default:
+					break;
+			}
 
-					xTaskCreatePinnedToCore(wakeDeviceTask, "wakeDeviceTask", 2048, (void *)device, 5, NULL, 1);
-				}
-			} break;
-			case 2: {
-				if (obj.containsKey("topic") && obj.containsKey("device")) {
-					statusMessageStruct *status = new statusMessageStruct;
-
-					status->topic = obj["topic"].as<String>();
-					status->mac = obj["device"]["MAC"].as<String>();
-					status->ip = obj["device"]["IP"].as<String>();
-
-					xTaskCreatePinnedToCore(deviceStatusTask, "deviceStatusTask", 2048, (void *)status, 4, NULL, 1);
-				}
-			} break;
-			default:
-				break;
+			if (taken)
+				requestRecord(obj["rid"]);
 		}
 	}
-}
 
-void mqttMessageQueueProcess() {
-	if (xSemaphoreTake(mqttQueueSemaphore, pdMS_TO_TICKS(10)) == pdFALSE)
-		return;
+	// Only remembered once taken on, so a redelivery or retry after a full job pool gets another try
+	if (taken)
+		messageRecord();
 
-	if (mqttMessagesQueueIndex == mqttMessagesQueueSize)
-		mqttMessagesQueueIndex = 0;
+#if defined(TRACE_PARSE_ALLOCATIONS)
+	uint32_t allocations = allocTraceEnd();
 
-	if (mqttMessagesQueue[mqttMessagesQueueIndex].waiting == true && millis() >= mqttMessagesQueue[mqttMessagesQueueIndex].nextTry) {
-		String data = mqttMessagesQueue[mqttMessagesQueueIndex].payload;
+	portENTER_CRITICAL(&dispatchStatsMux);
+	dispatchStats.parsedMessages++;
+	dispatchStats.parseAllocations += allocations;
+	portEXIT_CRITICAL(&dispatchStatsMux);
+#endif
+}
 
-		Sprintf("[%s] Sending: ", mqttMessagesQueue[mqttMessagesQueueIndex].topic.c_str());
-		Sprintln(data.c_str());
-		Sprintln();
+// False when the job pool or batch slots were full
+bool binaryMessageReceived(const uint8_t *data, size_t length, unsigned long receivedMicros) {
+	jobStruct job;
+	job.receivedMicros = receivedMicros;
 
-		bool res = client.publish(mqttMessagesQueue[mqttMessagesQueueIndex].topic, data);
-		if (res)
-			mqttMessagesQueue[mqttMessagesQueueIndex].waiting = false;
-		else {
-			mqttMessagesQueue[mqttMessagesQueueIndex].nextTry = millis() + FAILED_DELAY_MS;
-			lwMQTTErr(client.lastError());
-		}
+	if (length == 0) {
+		Lwarn("Failed: no msg id");
+		return true;
+	}
 
-		mqttMessagesQueueIndex++;
+	switch (data[0]) {
+		case 1: {
+			job.type = JOB_WAKE;
+
+			if (wireDecodeWake(data, length, &job.wake))
+				return dispatchJob(job);
+			else
+				Lwarn("Failed: invalid wake message");
+		} break;
+		case 2: {
+			job.type = JOB_STATUS;
+
+			if (wireDecodeStatus(data, length, &job.status))
+				return dispatchJob(job);
+			else
+				Lwarn("Failed: invalid status message");
+		} break;
+		case 3: {
+			job.type = JOB_WAKE_BATCH;
+			job.batch = wakeBatchAcquire();
+
+			if (job.batch == NULL)
+				return false;
+
+			if (wireDecodeBatch(data, length, job.batch))
+				return dispatchJob(job);
+
+			Lwarn("Failed: invalid batch wake");
+			wakeBatchRelease(job.batch);
+		} break;
+		default:
+			break;
 	}
 
-	xSemaphoreGive(mqttQueueSemaphore);
+	return true;
 }
 
-void wakeDeviceTask(void *pvParameters) {
-	wakeMessageStruct *device = (wakeMessageStruct *)pvParameters;
+void mqttMessageQueueProcess() {
+	uint8_t budget = MQTT_DRAIN_BUDGET;
+	uint8_t drained = 0;
 
-	bool status;
-	IPAddress deviceIP;
+	// Head slot is owned by this function, so publish runs without holding mqttQueueSemaphore
+	while (budget-- > 0) {
+		if (xSemaphoreTake(mqttQueueSemaphore, pdMS_TO_TICKS(10)) == pdFALSE)
+			break;
 
-	if (device->secureOn == false) {
-		Sprintf("WOL -> %s => ", device->mac.c_str());
-		status = WOL.sendMagicPacket(device->mac, device->port);
-	} else {
-		Sprintf("Secure WOL -> %s -> ", device->mac.c_str());
-		Sprintf("%s => ", device->secureOnPassword.c_str());
-		status = WOL.sendSecureMagicPacket(device->mac, device->secureOnPassword, device->port);
-	}
+		bool ready = mqttMessagesQueueCount > 0 && deadlineReached(mqttMessagesQueue[mqttMessagesQueueHead].nextTry, millis());
+		mqttMessageStruct *message = &mqttMessagesQueue[mqttMessagesQueueHead];
 
-	Sprintln(status);
+		xSemaphoreGive(mqttQueueSemaphore);
 
-	if (device->retrieveStatus == true) {
-		deviceIP.fromString(device->ip.c_str());
+		if (!ready)
+			break;
 
-		icmpRequstAdd(device->mac, deviceIP, device->topic, PING_RETRY_NUM);
-	}
+		Linfo("[%s] Sending %u bytes", logText(message->topic), message->length);
 
-	delete pvParameters;
-	vTaskDelete(NULL);
-}
+		if (!client.publish(message->topic, message->payload, message->length)) {
+			lwmqtt_err_t error = client.lastError();
+			healthMqttError(error);
 
-void deviceStatusTask(void *pvParameters) {
-	statusMessageStruct *status = (statusMessageStruct *)pvParameters;
-	IPAddress deviceIP;
+			Lwarn("[%s] publish failed: %s", logText(message->topic), lwMQTTErrName(error));
 
-	deviceIP.fromString(status->ip.c_str());
-	icmpRequstAdd(status->mac, deviceIP, status->topic, 1);
+			message->nextTry = millis() + mqttBackoff(message->retries++, MQTT_BACKOFF_BASE_MS, MQTT_BACKOFF_MAX_MS);
 
-	delete pvParameters;
-	vTaskDelete(NULL);
-}
+			xSemaphoreTake(mqttQueueSemaphore, portMAX_DELAY);
+			mqttStats.failed++;
+			xSemaphoreGive(mqttQueueSemaphore);
+			break;
+		}
 
-void ntpTask(void *pvParameters) {
-	struct tm timeinfo;
+		uint32_t latency = micros() - message->queuedMicros;
 
-	for (;;) {
-		if (!WiFi.isConnected()) {
-			vTaskDelay(pdMS_TO_TICKS(FAILED_DELAY_MS));  // 30000 = 30S
-			continue;
-		}
+		for (uint8_t i = 0; i < message->traceCount; i++)
+			traceMark(message->traceIds[i], TRACE_PUBLISHED);
 
-		vTaskDelay(pdMS_TO_TICKS(LONG_DELAY_MS));  // 3600000 = 1H
+		xSemaphoreTake(mqttQueueSemaphore, portMAX_DELAY);
+		mqttStats.published++;
+		mqttStats.retries += message->retries;
+		mqttStats.totalLatencyMicros += latency;
 
-		Sprintln("Updating time using NTP");
-		getLocalTime(&timeinfo, 0);
+		if (latency > mqttStats.maxLatencyMicros)
+			mqttStats.maxLatencyMicros = latency;
+
+		mqttMessagesQueueHead = (mqttMessagesQueueHead + 1) % mqttMessagesQueueSize;
+		mqttMessagesQueueCount--;
+		xSemaphoreGive(mqttQueueSemaphore);
+
+		drained++;
+	}
+
+	if (drained > 0) {
+		Ldebug("mqtt: drained %u | depth %u | max depth %u", drained, mqttMessagesQueueCount, mqttStats.maxDepth);
+		Ldebug("mqtt: avg latency %uus | max latency %uus | failed %u | retries %u", (uint32_t)(mqttStats.totalLatencyMicros / mqttStats.published), mqttStats.maxLatencyMicros, mqttStats.failed, mqttStats.retries);
 	}
 }
 
-#if defined(SCHEDULE_RESTART)
-void restartTask(void *pvParameters) {
-	for (;;) {
-		vTaskDelay(pdMS_TO_TICKS(LONG_DELAY_MS));
+// Exponential backoff with equal jitter: half of the window is fixed, half is random
+uint32_t mqttBackoff(uint8_t retries, uint32_t baseMs, uint32_t maxMs) {
+	uint32_t backoff = maxMs;
 
-		if (millis() >= ((unsigned long)SCHEDULE_RESTART_MILLIS * 1000))  // SCHEDULE_RESTART_MILLIS
-			break;
-	}
+	if (retries < 16)
+		backoff = min(baseMs << retries, maxMs);
 
-	prepareRestart();
-	vTaskDelete(NULL);
+	return backoff / 2 + esp_random() % (backoff / 2 + 1);
 }
-#endif
 
-void icmpTask(void *pvParameters) {
-	for (;;) {
-		bool queueIsEmpty = true;
+// {"id": 5, "action": "set" | "remove" | "list", "device": ID, "record": {...}, "start": first ID listed, "topic": reply topic}
+// A list reply is one page {"id": 5, "action": "list", "devices": [...], "next": ID}, "next" is left out on the last page
+void registryCommand(JsonObject obj) {
+	const char *action = obj["action"] | "list";
+	const char *topic = obj["topic"] | "";
+	const int id = obj["device"] | -1;
 
-		if (!WiFi.isConnected()) {
-			vTaskDelay(pdMS_TO_TICKS(FAILED_DELAY_MS));
-			continue;
-		}
+	StaticJsonDocument<JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(REGISTRY_LIST_CHUNK) + REGISTRY_LIST_CHUNK * JSON_OBJECT_SIZE(7)> jsonBuffer;
+	char data[MQTT_PAYLOAD_SIZE];
+	deviceRecordStruct record, previous;
 
-		if (xSemaphoreTake(icmpQueueSemaphore, pdMS_TO_TICKS(1000)) == pdTRUE) {
-			for (uint8_t i = 0; i < icmpQueueSize; i++) {
-				if (icmpQueue[i].waiting == true && millis() >= icmpQueue[i].nextICMP) {
-					Sprint("> ping ");
-					Sprintln(icmpQueue[i].ip.toString());
+	if (strcmp(action, "list") == 0) {
+		// Nowhere to send it
+		if (topic[0] == '\0')
+			return;
+
+		char macStrings[REGISTRY_LIST_CHUNK][MAC_STRING_SIZE];
+		char ipStrings[REGISTRY_LIST_CHUNK][16];
+		char broadcastStrings[REGISTRY_LIST_CHUNK][16];
+		const size_t nextSize = sizeof(",\"next\":65535") - 1;
+		int next = -1;
+		uint8_t chunk = 0;
+
+		JsonObject rootJSON = jsonBuffer.to<JsonObject>();
+		rootJSON["id"] = 5;
+		rootJSON["action"] = "list";
+		JsonArray devices = rootJSON.createNestedArray("devices");
+
+		// One page per request: the whole table would be more messages than MQTT_QUEUE_SIZE,
+		// and nothing is published while this callback runs
+		for (int i = max(obj["start"] | 0, 0); i < REGISTRY_SIZE; i++) {
+			if (!registryGet(i, &record))
+				continue;
+
+			if (chunk == REGISTRY_LIST_CHUNK) {
+				next = i;
+				break;
+			}
 
-					bool pingResult = Ping.ping(icmpQueue[i].ip);
+			JsonObject recordJSON = devices.createNestedObject();
 
-					Sprintf(">> %d\n", pingResult);
+			macToString(record.mac, macStrings[chunk]);
 
-					icmpQueue[i].tries--;
-					icmpQueue[i].nextICMP = millis() + PING_BETWEEN_DELAY_MS;
+			recordJSON["device"] = i;
+			recordJSON["MAC"] = (const char *)macStrings[chunk];
+			recordJSON["port"] = record.port;
+			if (record.ip != 0) {
+				IPAddress ip(record.ip);
 
-					Sprintf("tries: %d\n", icmpQueue[i].tries);
+				snprintf(ipStrings[chunk], sizeof(ipStrings[chunk]), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+				recordJSON["ip"] = (const char *)ipStrings[chunk];
+			}
+			recordJSON["secureOn"] = record.secureOn;
 
-					if (pingResult == true || icmpQueue[i].tries == 0) {
-						icmpQueue[i].waiting = false;
-						addDeviceStatus(icmpQueue[i].mac, icmpQueue[i].topic, pingResult);
-					}
-				}
+			if (record.target.delivery == DELIVER_DIRECTED) {
+				IPAddress broadcast(record.target.address);
 
-				if (icmpQueue[i].waiting == true)
-					queueIsEmpty = false;
+				snprintf(broadcastStrings[chunk], sizeof(broadcastStrings[chunk]), "%u.%u.%u.%u", broadcast[0], broadcast[1], broadcast[2], broadcast[3]);
+				recordJSON["broadcast"] = (const char *)broadcastStrings[chunk];
+			} else if (record.target.delivery == DELIVER_UNICAST)
+				recordJSON["unicast"] = true;
+
+			// serializeJson() truncates silently, a device that does not fit starts the next page
+			if (chunk > 0 && measureJson(rootJSON) + nextSize >= sizeof(data)) {
+				devices.remove(chunk);
+				next = i;
+				break;
 			}
 
-			xSemaphoreGive(icmpQueueSemaphore);
+			chunk++;
 		}
 
-		if (queueIsEmpty == true)
-			vTaskSuspend(NULL);
-		else
-			vTaskDelay(pdMS_TO_TICKS(10));
+		if (next >= 0)
+			rootJSON["next"] = next;
+
+		serializeJson(rootJSON, data, sizeof(data));
+		mqttMessageAdd(topic, data);
+		return;
+	}
+
+	bool hadPrevious = registryGet(id, &previous);
+	bool ok = false;
+
+	if (strcmp(action, "set") == 0 && obj["record"].is<JsonObject>() && parseDeviceRecord(obj["record"], &record))
+		ok = registrySet(id, &record);
+	else if (strcmp(action, "remove") == 0)
+		ok = registryRemove(id);
+
+	// Packets for the old MAC/password must not be served again
+	if (ok && hadPrevious) {
+		xSemaphoreTake(udpSemaphore, portMAX_DELAY);
+		magicPacketCacheInvalidate(previous.mac);
+		xSemaphoreGive(udpSemaphore);
+	}
+
+	Linfo("Registry %s %d => %d", logText(action), id, ok);
+
+	if (topic[0] != '\0') {
+		JsonObject rootJSON = jsonBuffer.to<JsonObject>();
+		rootJSON["id"] = 5;
+		rootJSON["action"] = action;
+		rootJSON["device"] = id;
+		rootJSON["ok"] = ok;
+
+		serializeJson(rootJSON, data, sizeof(data));
+		mqttMessageAdd(topic, data);
 	}
 }
 
-void icmpRequstAdd(String &mac, IPAddress ip, String &topic, uint8_t maxTries) {
-	bool addedToQueue = false;
+#if defined(SCHEDULED_WAKES)
+// {"id": 8, "action": "set" | "remove" | "list", "schedule": ID, "cron": "30 2 * * *", "wake": {wake message}, "start": first ID listed, "topic": reply topic}
+// A list reply is one page {"id": 8, "action": "list", "schedules": [...], "next": ID}, "next" is left out on the last page
+void scheduleCommand(JsonObject obj) {
+	const char *action = obj["action"] | "list";
+	const char *topic = obj["topic"] | "";
+	const int id = obj["schedule"] | -1;
 
-	if (xSemaphoreTake(icmpQueueSemaphore, pdMS_TO_TICKS(1000)) == pdTRUE) {
-		for (uint8_t i = 0; i < icmpQueueSize; i++) {
-			if (icmpQueue[i].waiting == true && icmpQueue[i].ip == ip) {
-				addedToQueue = true;
-				break;
-			}
+	StaticJsonDocument<JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(SCHEDULE_LIST_CHUNK) + SCHEDULE_LIST_CHUNK * JSON_OBJECT_SIZE(4)> jsonBuffer;
+	char data[MQTT_PAYLOAD_SIZE];
+
+	if (strcmp(action, "list") == 0) {
+		// Nowhere to send it
+		if (topic[0] == '\0')
+			return;
 
-			if (icmpQueue[i].waiting == false) {
-				icmpQueue[i].waiting = true;
+		// One more than a page holds, it finds where the next page starts
+		scheduleRecordStruct records[SCHEDULE_LIST_CHUNK + 1];
+		const size_t nextSize = sizeof(",\"next\":127") - 1;
+		int next = -1;
+		uint8_t chunk = 0;
 
-				icmpQueue[i].mac = mac;
-				icmpQueue[i].ip = ip;
+		JsonObject rootJSON = jsonBuffer.to<JsonObject>();
+		rootJSON["id"] = 8;
+		rootJSON["action"] = "list";
+		JsonArray schedules = rootJSON.createNestedArray("schedules");
+
+		// One page per request, the requester asks for "next" once this one arrived
+		for (int i = max(obj["start"] | 0, 0); i < SCHEDULE_SIZE; i++) {
+			if (!scheduleGet(i, &records[chunk]))
+				continue;
+
+			if (chunk == SCHEDULE_LIST_CHUNK) {
+				next = i;
+				break;
+			}
 
-				icmpQueue[i].topic = topic;
+			JsonObject recordJSON = schedules.createNestedObject();
 
-				icmpQueue[i].tries = maxTries;
+			recordJSON["schedule"] = i;
+			recordJSON["cron"] = (const char *)records[chunk].cron;
+			recordJSON["next"] = (uint32_t)scheduleNextDue(i);  // 0 until NTP time is set
+			recordJSON["wake"] = serialized((const char *)records[chunk].wake);
 
-				addedToQueue = true;
+			// serializeJson() truncates silently, a schedule that does not fit starts the next page
+			if (chunk > 0 && measureJson(rootJSON) + nextSize >= sizeof(data)) {
+				schedules.remove(chunk);
+				next = i;
 				break;
 			}
+
+			chunk++;
 		}
 
-		xSemaphoreGive(icmpQueueSemaphore);
-	}
+		if (next >= 0)
+			rootJSON["next"] = next;
 
-	if (addedToQueue)
-		vTaskResume(icmpTaskHandler);
-	else {
-		vTaskDelay(pdMS_TO_TICKS(FAILED_DELAY_MS));
-		icmpRequstAdd(mac, ip, topic, maxTries);
+		serializeJson(rootJSON, data, sizeof(data));
+		mqttMessageAdd(topic, data);
+		return;
 	}
-}
 
-void addDeviceStatus(String &mac, String &topic, bool status) {
-	bool addedToQueue = false;
+	bool ok = false;
 
-	if (xSemaphoreTake(mqttQueueSemaphore, pdMS_TO_TICKS(1000)) == pdTRUE) {
-		for (uint8_t i = 0; i < mqttMessagesQueueSize; i++) {
-			if (mqttMessagesQueue[i].waiting == false) {
-				DynamicJsonDocument jsonBuffer(JSON_OBJECT_SIZE(4) + 100);
+	if (strcmp(action, "set") == 0 && obj["wake"].is<JsonObject>()) {
+		const char *cron = obj["cron"] | "";
+		JsonObject wakeJSON = obj["wake"].as<JsonObject>();
+		scheduleRecordStruct record;
+		wakeMessageStruct wake;
+
+		memset(&record, 0, sizeof(scheduleRecordStruct));
 
-				JsonObject rootJSON = jsonBuffer.to<JsonObject>();
-				rootJSON["MAC"] = mac.c_str();
-				rootJSON["pingResult"] = status;
+		// Parsed once here so a bad wake is refused now rather than at every run
+		if (strlen(cron) < SCHEDULE_CRON_SIZE && measureJson(wakeJSON) < SCHEDULE_WAKE_SIZE && parseWakeMessage(wakeJSON, &wake)) {
+			strcpy(record.cron, cron);
+			serializeJson(wakeJSON, record.wake, sizeof(record.wake));
 
-				char data[measureJson(rootJSON) + 1];
-				serializeJson(rootJSON, data, sizeof(data));
+			ok = scheduleSet(id, &record);
+		}
+	} else if (strcmp(action, "remove") == 0)
+		ok = scheduleRemove(id);
 
-				mqttMessagesQueue[i].waiting = true;
+	Linfo("Schedule %s %d => %d", logText(action), id, ok);
 
-				mqttMessagesQueue[i].topic = topic;
-				mqttMessagesQueue[i].payload = data;
+	if (topic[0] != '\0') {
+		JsonObject rootJSON = jsonBuffer.to<JsonObject>();
+		rootJSON["id"] = 8;
+		rootJSON["action"] = action;
+		rootJSON["schedule"] = id;
+		rootJSON["ok"] = ok;
+		rootJSON["next"] = (uint32_t)scheduleNextDue(id);
 
-				mqttMessagesQueue[i].nextTry = 0;
+		serializeJson(rootJSON, data, sizeof(data));
+		mqttMessageAdd(topic, data);
+	}
+}
 
-				addedToQueue = true;
-				break;
-			}
+// Ticks the schedule wheel just after every wall-clock minute, once NTP has set the time
+void scheduleTask(void *pvParameters) {
+	uint8_t due[SCHEDULE_SIZE];
+
+	for (;;) {
+		time_t now = time(nullptr);
+
+		if (timeSet && now > BUILD_TIMESTAMP) {
+			uint8_t count = scheduleAdvance(now, due);
+
+			for (uint8_t i = 0; i < count; i++)
+				scheduleFire(due[i], now);
 		}
 
-		xSemaphoreGive(mqttQueueSemaphore);
+		vTaskDelay(pdMS_TO_TICKS((60 - now % 60) * 1000 + 100));
 	}
+}
+
+// Dispatches the stored wake like one received on AWS_WAKE_CHANNEL, no broker needed
+void scheduleFire(uint8_t id, time_t now) {
+	StaticJsonDocument<JSON_OBJECT_SIZE(12) + SCHEDULE_WAKE_SIZE> wakeDoc;
+	scheduleRecordStruct record;
+	bool dispatched = false;
+	jobStruct job;
+
+	if (!scheduleGet(id, &record))
+		return;
+
+	memset(&job.wake, 0, sizeof(wakeMessageStruct));
+	job.type = JOB_WAKE;
+	job.receivedMicros = micros();
+
+	// Parsed again each run, a registry device picks up its current record
+	DeserializationError error = deserializeJson(wakeDoc, (const char *)record.wake);
 
-	if (!addedToQueue) {
-		vTaskDelay(pdMS_TO_TICKS(FAILED_DELAY_MS));
-		addDeviceStatus(mac, topic, status);
+	if (!error && parseWakeMessage(wakeDoc.as<JsonObject>(), &job.wake))
+		dispatched = dispatchJob(job);
+
+	Linfo("Schedule %u fired => %d", id, dispatched);
+
+	// Queued like every reply, published once the broker is reachable
+	if (job.wake.topic[0] != '\0') {
+		StaticJsonDocument<JSON_OBJECT_SIZE(4)> jsonBuffer;
+		char data[MQTT_PAYLOAD_SIZE];
+
+		JsonObject rootJSON = jsonBuffer.to<JsonObject>();
+		rootJSON["id"] = 9;
+		rootJSON["schedule"] = id;
+		rootJSON["at"] = (uint32_t)now;
+		rootJSON["ok"] = dispatched;
+
+		serializeJson(rootJSON, data, sizeof(data));
+		mqttMessageAdd(job.wake.topic, data);
 	}
 }
+#endif
 
-void prepareRestart() {
-	Sprint("prepareRestart()");
+// QoS 1 redelivery (DUP set) of a packet ID already handled within DEDUP_WINDOW_MS
+bool messageDuplicate() {
+	mqttPublishInfo publish = dedupLastPublish();
 
-	if (client.connected()) {
-		client.unsubscribe(AWS_WAKE_CHANNEL);
-		client.disconnect();
+	if (publish.qos == LWMQTT_QOS0)
+		return false;
+
+	if (publish.dup && dedupSeen(DEDUP_PACKET, publish.packetId)) {
+		Linfo("Duplicate packet %u skipped", publish.packetId);
+
+		portENTER_CRITICAL(&dispatchStatsMux);
+		dispatchStats.duplicates++;
+		portEXIT_CRITICAL(&dispatchStatsMux);
+		return true;
 	}
-	if (WiFi.isConnected())
-		WiFi.disconnect();
 
-	esp_restart();
+	return false;
 }
 
-void lwMQTTErr(lwmqtt_err_t reason) {
-	if (reason == lwmqtt_err_t::LWMQTT_SUCCESS)
-		Sprint("Success");
-	else if (reason == lwmqtt_err_t::LWMQTT_BUFFER_TOO_SHORT)
-		Sprint("Buffer too short");
-	else if (reason == lwmqtt_err_t::LWMQTT_VARNUM_OVERFLOW)
-		Sprint("Varnum overflow");
-	else if (reason == lwmqtt_err_t::LWMQTT_NETWORK_FAILED_CONNECT)
-		Sprint("Network failed connect");
-	else if (reason == lwmqtt_err_t::LWMQTT_NETWORK_TIMEOUT)
-		Sprint("Network timeout");
-	else if (reason == lwmqtt_err_t::LWMQTT_NETWORK_FAILED_READ)
-		Sprint("Network failed read");
-	else if (reason == lwmqtt_err_t::LWMQTT_NETWORK_FAILED_WRITE)
-		Sprint("Network failed write");
-	else if (reason == lwmqtt_err_t::LWMQTT_REMAINING_LENGTH_OVERFLOW)
-		Sprint("Remaining length overflow");
-	else if (reason == lwmqtt_err_t::LWMQTT_REMAINING_LENGTH_MISMATCH)
-		Sprint("Remaining length mismatch");
-	else if (reason == lwmqtt_err_t::LWMQTT_MISSING_OR_WRONG_PACKET)
-		Sprint("Missing or wrong packet");
-	else if (reason == lwmqtt_err_t::LWMQTT_CONNECTION_DENIED)
-		Sprint("Connection denied");
-	else if (reason == lwmqtt_err_t::LWMQTT_FAILED_SUBSCRIPTION)
-		Sprint("Failed subscription");
-	else if (reason == lwmqtt_err_t::LWMQTT_SUBACK_ARRAY_OVERFLOW)
-		Sprint("Suback array overflow");
-	else if (reason == lwmqtt_err_t::LWMQTT_PONG_TIMEOUT)
-		Sprint("Pong timeout");
+void messageRecord() {
+	mqttPublishInfo publish = dedupLastPublish();
+
+	if (publish.qos != LWMQTT_QOS0)
+		dedupRecord(DEDUP_PACKET, publish.packetId);
 }
 
-void lwMQTTErrConnection(lwmqtt_return_code_t reason) {
-	if (reason == lwmqtt_return_code_t::LWMQTT_CONNECTION_ACCEPTED)
-		Sprint("Connection Accepted");
-	else if (reason == lwmqtt_return_code_t::LWMQTT_UNACCEPTABLE_PROTOCOL)
-		Sprint("Unacceptable Protocol");
-	else if (reason == lwmqtt_return_code_t::LWMQTT_IDENTIFIER_REJECTED)
-		Sprint("Identifier Rejected");
-	else if (reason == lwmqtt_return_code_t::LWMQTT_SERVER_UNAVAILABLE)
-		Sprint("Server Unavailable");
-	else if (reason == lwmqtt_return_code_t::LWMQTT_BAD_USERNAME_OR_PASSWORD)
-		Sprint("Bad UserName/Password");
-	else if (reason == lwmqtt_return_code_t::LWMQTT_NOT_AUTHORIZED)
-		Sprint("Not Authorized");
-	else if (reason == lwmqtt_return_code_t::LWMQTT_UNKNOWN_RETURN_CODE)
-		Sprint("Unknown Return Code");
+// Optional "rid" (string or number) set by the client, catches the app resending a request itself
+bool requestDuplicate(JsonVariant rid) {
+	uint32_t key;
+
+	if (!requestKey(rid, &key))
+		return false;
+
+	if (dedupSeen(DEDUP_REQUEST, key)) {
+		portENTER_CRITICAL(&dispatchStatsMux);
+		dispatchStats.duplicates++;
+		portEXIT_CRITICAL(&dispatchStatsMux);
+		return true;
+	}
+
+	return false;
 }
 
-IPAddress getNetworkID(IPAddress ip, IPAddress subnet) {
-	IPAddress networkID;
+void requestRecord(JsonVariant rid) {
+	uint32_t key;
 
-	for (size_t i = 0; i < 4; i++)
-		networkID[i] = subnet[i] & ip[i];
+	if (requestKey(rid, &key))
+		dedupRecord(DEDUP_REQUEST, key);
+}
 
-	return networkID;
+bool requestKey(JsonVariant rid, uint32_t *key) {
+	if (rid.isNull())
+		return false;
+
+	if (rid.is<const char *>()) {
+		const char *text = rid.as<const char *>();
+		*key = dedupHash(text, strlen(text));
+	} else
+		*key = rid.as<uint32_t>();
+
+	return true;
+}
+
+bool sendMagicPacket(const uint8_t *mac, const uint8_t *secureOn, uint16_t port, const wakeTargetStruct *target) {
+	bool status = true, staticArp;
+	size_t size;
+
+	discoveryDefer();
+
+	xSemaphoreTake(udpSemaphore, portMAX_DELAY);
+
+	const uint8_t *packet = magicPacketCacheGet(mac, secureOn, &size);
+	IPAddress address(wakeTargetAcquire(mac, target, &staticArp));
+
+	for (uint8_t repeat = 0; repeat < REPEAT_MAGIC_PACKET; repeat++) {
+		if (repeat > 0)
+			vTaskDelay(pdMS_TO_TICKS(REPEAT_MAGIC_PACKET_DELAY_MS));
+
+		UDP.beginPacket(address, port);
+		UDP.write(packet, size);
+
+		if (!UDP.endPacket())
+			status = false;
+	}
+
+	if (staticArp)
+		arpStaticRemove(address);
+
+	xSemaphoreGive(udpSemaphore);
+
+	return status;
+}
+
+// Destination of the magic packets. A unicast host on our subnet gets a static ARP entry for the
+// burst (staticArp set, the caller removes it), a sleeping NIC does not answer ARP itself.
+// Falls back to broadcast when the entry cannot be added.
+// Caller must hold udpSemaphore
+uint32_t wakeTargetAcquire(const uint8_t *mac, const wakeTargetStruct *target, bool *staticArp) {
+	uint32_t ip = target->address;
+
+	*staticArp = false;
+
+	switch (target->delivery) {
+		case DELIVER_DIRECTED:
+			return ip;
+		case DELIVER_UNICAST:
+			if (ip == 0 && !discoveryLookup(mac, &ip))
+				break;
+
+			// Without the entry the packets would wait on an ARP reply the sleeping NIC never sends
+			if (onLocalSubnet(IPAddress(ip))) {
+				*staticArp = arpStaticAdd(ip, mac);
+				if (!*staticArp)
+					break;
+			}
+
+			return ip;
+		default:
+			break;
+	}
+
+	return broadcastAddress;
+}
+
+void wakeDevice(wakeMessageStruct *device, uint16_t traceId) {
+#if defined(WAKE_SCHEDULER)
+	uint8_t position;
+	uint32_t eta;
+
+	if (wakeSchedulerTake(1) == 0) {
+		if (wakeSchedulerEnqueue(device, traceId, &position, &eta))
+			wakeQueuedReply(device, position, eta, traceId);
+		else
+			Lwarn("Wake queue full, wake dropped");
+
+		return;
+	}
+#endif
+
+	wakeSend(device, traceId);
+}
+
+// Magic packets now, then the status check (joining one in flight for a suppressed wake)
+void wakeSend(wakeMessageStruct *device, uint16_t traceId) {
+	char macString[MAC_STRING_SIZE];
+	bool status;
+
+	macToString(device->mac, macString);
+
+	// The status request below joins the check of the earlier wake
+	if (!wakeGuardClaim(device->mac)) {
+		Linfo("WOL -> %s suppressed, woken recently", logText(macString));
+		status = true;
+	} else {
+		status = sendMagicPacket(device->mac, device->secureOn ? device->secureOnPassword : NULL, device->port, &device->target);
+
+		Linfo("%sWOL -> %s => %d", device->secureOn ? "Secure " : "", logText(macString), status);
+	}
+
+	traceMark(traceId, TRACE_SENT);
+
+	if (device->retrieveStatus == true)
+		icmpRequstAdd(device->mac, IPAddress(device->ip), device->topic, device->format, device->probe, true, traceId);
+}
+
+#if defined(WAKE_SCHEDULER)
+// {"id": 7, "MAC": ..., "position": 1 = next, "eta": ms} or WIRE_WAKE_QUEUED
+void wakeQueuedReply(const wakeMessageStruct *device, uint8_t position, uint32_t etaMillis, uint16_t traceId) {
+	if (device->topic[0] == '\0')
+		return;
+
+	if (device->format == FORMAT_BINARY) {
+		uint8_t data[2 + MAC_ADDRESS_SIZE + 4];
+		size_t length = wireEncodeWakeQueued(device->mac, position, etaMillis, data, sizeof(data));
+
+		mqttMessageAdd(device->topic, data, length, &traceId, 1);
+		return;
+	}
+
+	StaticJsonDocument<JSON_OBJECT_SIZE(4)> jsonBuffer;
+	char macString[MAC_STRING_SIZE];
+	char data[MQTT_PAYLOAD_SIZE];
+
+	macToString(device->mac, macString);
+
+	JsonObject rootJSON = jsonBuffer.to<JsonObject>();
+	rootJSON["id"] = 7;
+	rootJSON["MAC"] = (const char *)macString;
+	rootJSON["position"] = position;
+	rootJSON["eta"] = etaMillis;
+
+	serializeJson(rootJSON, data, sizeof(data));
+	mqttMessageAdd(device->topic, (const uint8_t *)data, strlen(data), &traceId, 1);
+}
+
+// Sends queued wakes as tokens come in, one at a time so their status checks start spaced out too
+void wakeSchedulerTask(void *pvParameters) {
+	wakeQueuedStruct job;
+
+	for (;;) {
+		wakeSchedulerNext(&job);
+		wakeSend(&job.device, job.traceId);
+	}
+}
+#endif
+
+void deviceStatus(statusMessageStruct *status, uint16_t traceId) {
+	icmpRequstAdd(status->mac, IPAddress(status->ip), status->topic, status->format, status->probe, false, traceId);
+}
+
+void wakeBatch(wakeBatchStruct *batch, uint16_t traceId) {
+	uint8_t sent = 0, suppressed = 0, statusQueued = 0;
+	uint8_t immediate = batch->count, queued = 0, position = 0;
+	uint32_t eta = 0;
+	bool send[WAKE_BATCH_MAX], staticArp[WAKE_BATCH_MAX];
+	uint32_t addresses[WAKE_BATCH_MAX];
+
+#if defined(WAKE_SCHEDULER)
+	immediate = wakeSchedulerTake(batch->count);
+
+	// The rest are claimed, sent and checked one by one by wakeSchedulerTask
+	for (uint8_t i = immediate; i < batch->count; i++) {
+		batchDeviceStruct *entry = &batch->devices[i];
+		wakeMessageStruct device;
+
+		device.format = batch->format;
+		memcpy(device.mac, entry->mac, MAC_ADDRESS_SIZE);
+		device.port = entry->port;
+		device.retrieveStatus = entry->retrieveStatus;
+		strcpy(device.topic, batch->topic);
+		device.ip = entry->ip;
+		device.probe = entry->probe;
+		device.secureOn = entry->secureOn;
+		memcpy(device.secureOnPassword, entry->secureOnPassword, SECURE_ON_SIZE);
+		device.target = entry->target;
+
+		if (wakeSchedulerEnqueue(&device, traceId, &position, &eta))
+			queued++;
+	}
+
+	if (queued < batch->count - immediate)
+		Lwarn("Wake queue full, %u batch wakes dropped", batch->count - immediate - queued);
+#endif
+
+	for (uint8_t i = 0; i < immediate; i++) {
+		send[i] = wakeGuardClaim(batch->devices[i].mac);
+
+		// Counted as sent, a wake for it is already out
+		if (!send[i]) {
+			suppressed++;
+			sent++;
+		}
+	}
+
+	discoveryDefer();
+
+	// One burst per repeat instead of REPEAT_MAGIC_PACKET sequential sends per device,
+	// whatever mix of local, directed and unicast targets the batch has
+	xSemaphoreTake(udpSemaphore, portMAX_DELAY);
+
+	for (uint8_t i = 0; i < immediate; i++)
+		addresses[i] = send[i] ? wakeTargetAcquire(batch->devices[i].mac, &batch->devices[i].target, &staticArp[i]) : 0;
+
+	// Built once per batch for every repeat. A batch larger than the cache would only evict it all,
+	// such batches build their packets directly
+	for (uint8_t i = 0; i < immediate; i++) {
+		batchDeviceStruct *device = &batch->devices[i];
+		const uint8_t *secureOn = device->secureOn ? device->secureOnPassword : NULL;
+		size_t size;
+
+		if (!send[i])
+			continue;
+
+		if (immediate <= MAGIC_PACKET_CACHE_SIZE) {
+			const uint8_t *packet = magicPacketCacheGet(device->mac, secureOn, &size);
+
+			memcpy(wakeBatchPackets[i], packet, size);
+		} else
+			size = buildMagicPacket(wakeBatchPackets[i], device->mac, secureOn);
+
+		wakeBatchPacketSizes[i] = size;
+	}
+
+	for (uint8_t repeat = 0; repeat < REPEAT_MAGIC_PACKET; repeat++) {
+		if (repeat > 0)
+			vTaskDelay(pdMS_TO_TICKS(REPEAT_MAGIC_PACKET_DELAY_MS));
+
+		for (uint8_t i = 0; i < immediate; i++) {
+			if (!send[i])
+				continue;
+
+			UDP.beginPacket(IPAddress(addresses[i]), batch->devices[i].port);
+			UDP.write(wakeBatchPackets[i], wakeBatchPacketSizes[i]);
+
+			if (UDP.endPacket() && repeat == 0)
+				sent++;
+		}
+	}
+
+	for (uint8_t i = 0; i < immediate; i++) {
+		if (send[i] && staticArp[i])
+			arpStaticRemove(addresses[i]);
+	}
+
+	xSemaphoreGive(udpSemaphore);
+
+	Linfo("Batch WOL -> %u devices => %u sent, %u suppressed, %u queued", batch->count, sent, suppressed, queued);
+
+	if (immediate > 0)
+		traceMark(traceId, TRACE_SENT);
+
+	if (xSemaphoreTake(icmpQueueSemaphore, pdMS_TO_TICKS(1000)) == pdTRUE) {
+		for (uint8_t i = 0; i < immediate; i++) {
+			batchDeviceStruct *device = &batch->devices[i];
+
+			if (device->retrieveStatus && icmpQueueInsert(device->mac, IPAddress(device->ip), batch->topic, batch->format, device->probe, true, traceId))
+				statusQueued++;
+		}
+
+		xSemaphoreGive(icmpQueueSemaphore);
+	}
+
+	if (statusQueued > 0)
+		xTaskNotifyGive(icmpTaskHandler);
+
+	if (batch->topic[0] != '\0' && batch->format == FORMAT_BINARY) {
+		uint8_t data[9];
+		size_t length = wireEncodeBatchAck(batch->count, sent, statusQueued, queued, eta, data, sizeof(data));
+
+		mqttMessageAdd(batch->topic, data, length, &traceId, 1);
+	} else if (batch->topic[0] != '\0') {
+		StaticJsonDocument<JSON_OBJECT_SIZE(6)> jsonBuffer;
+
+		JsonObject rootJSON = jsonBuffer.to<JsonObject>();
+		rootJSON["id"] = 3;
+		rootJSON["devices"] = batch->count;
+		rootJSON["sent"] = sent;
+		rootJSON["statusQueued"] = statusQueued;
+		rootJSON["queued"] = queued;
+		rootJSON["eta"] = eta;  // ms until the last queued device is woken
+
+		char data[MQTT_PAYLOAD_SIZE];
+		serializeJson(rootJSON, data, sizeof(data));
+
+		mqttMessageAdd(batch->topic, (const uint8_t *)data, strlen(data), &traceId, 1);
+	}
+}
+
+// The trace starts here, once the message is known to be a valid wake/status/batch job,
+// so rejected and non-job messages do not evict live traces from the ring
+bool dispatchJob(jobStruct &job) {
+	job.traceId = traceBegin(job.receivedMicros);
+	traceMark(job.traceId, TRACE_PARSED);
+
+#if defined(WORKER_POOL)
+	if (xQueueSend(jobQueue, &job, 0) == pdTRUE)
+		return true;
+
+	Lwarn("Worker pool full, message dropped");
+#else
+	jobStruct *copy = new jobStruct(job);
+
+	if (xTaskCreatePinnedToCore(jobTask, "jobTask", WORKER_STACK_SIZE, (void *)copy, 5, NULL, 1) == pdPASS)
+		return true;
+
+	delete copy;
+#endif
+
+	if (job.type == JOB_WAKE_BATCH)
+		wakeBatchRelease(job.batch);
+
+	portENTER_CRITICAL(&dispatchStatsMux);
+	dispatchStats.dropped++;
+	portEXIT_CRITICAL(&dispatchStatsMux);
+
+	return false;
+}
+
+void runJob(jobStruct *job) {
+	traceMark(job->traceId, TRACE_DISPATCHED);
+
+	if (job->type == JOB_WAKE)
+		wakeDevice(&job->wake, job->traceId);
+	else if (job->type == JOB_STATUS)
+		deviceStatus(&job->status, job->traceId);
+	else if (job->type == JOB_WAKE_BATCH) {
+		wakeBatch(job->batch, job->traceId);
+		wakeBatchRelease(job->batch);
+	}
+
+	dispatchStatsRecord(job->receivedMicros);
+}
+
+#if defined(WORKER_POOL)
+void workerTask(void *pvParameters) {
+	jobStruct job;
+
+	for (;;) {
+		if (xQueueReceive(jobQueue, &job, portMAX_DELAY) == pdTRUE)
+			runJob(&job);
+	}
+}
+#else
+void jobTask(void *pvParameters) {
+	jobStruct *job = (jobStruct *)pvParameters;
+
+	runJob(job);
+
+	delete job;
+	vTaskDelete(NULL);
+}
+#endif
+
+wakeBatchStruct *wakeBatchAcquire() {
+#if defined(WORKER_POOL)
+	uint8_t slot;
+
+	if (xQueueReceive(wakeBatchFreeQueue, &slot, 0) == pdTRUE)
+		return &wakeBatchSlots[slot];
+
+	Lwarn("Batch slots full, message dropped");
+
+	portENTER_CRITICAL(&dispatchStatsMux);
+	dispatchStats.dropped++;
+	portEXIT_CRITICAL(&dispatchStatsMux);
+
+	return NULL;
+#else
+	return new wakeBatchStruct;
+#endif
+}
+
+void wakeBatchRelease(wakeBatchStruct *batch) {
+#if defined(WORKER_POOL)
+	uint8_t slot = batch - wakeBatchSlots;
+
+	xQueueSend(wakeBatchFreeQueue, &slot, portMAX_DELAY);
+#else
+	delete batch;
+#endif
+}
+
+// Same counters for both dispatch paths, toggle WORKER_POOL to compare them
+void dispatchStatsRecord(unsigned long receivedMicros) {
+	uint32_t latency = micros() - receivedMicros;
+	uint32_t freeHeap = ESP.getFreeHeap();
+
+	portENTER_CRITICAL(&dispatchStatsMux);
+	dispatchStats.requests++;
+	dispatchStats.totalLatencyMicros += latency;
+
+	if (latency > dispatchStats.maxLatencyMicros)
+		dispatchStats.maxLatencyMicros = latency;
+
+	if (freeHeap < dispatchStats.lowestFreeHeap)
+		dispatchStats.lowestFreeHeap = freeHeap;
+
+	// Only read for the debug log, the cache stats need udpSemaphore which a wake holds for its whole burst
+#if defined(PRINT_TO_SERIAL) && LOG_LEVEL >= LOG_DEBUG
+	dispatchStatsStruct snapshot = dispatchStats;
+	portEXIT_CRITICAL(&dispatchStatsMux);
+
+	Ldebug("dispatch: requests %u | dropped %u | avg %uus | max %uus", snapshot.requests, snapshot.dropped, (uint32_t)(snapshot.totalLatencyMicros / snapshot.requests), snapshot.maxLatencyMicros);
+	Ldebug("dispatch: peak heap use %u | parse allocations %u", snapshot.lowestFreeHeap < snapshot.baselineFreeHeap ? snapshot.baselineFreeHeap - snapshot.lowestFreeHeap : 0, snapshot.parseAllocations);
+
+	xSemaphoreTake(udpSemaphore, portMAX_DELAY);
+	magicPacketCacheStats cache = magicPacketCacheGetStats();
+	xSemaphoreGive(udpSemaphore);
+
+	Ldebug("packet cache: hits %u | misses %u | evictions %u", cache.hits, cache.misses, cache.evictions);
+#else
+	portEXIT_CRITICAL(&dispatchStatsMux);
+#endif
+}
+
+void ntpTask(void *pvParameters) {
+	struct tm timeinfo;
+
+	for (;;) {
+		if (!WiFi.isConnected()) {
+			vTaskDelay(pdMS_TO_TICKS(FAILED_DELAY_MS));  // 30000 = 30S
+			continue;
+		}
+
+		vTaskDelay(pdMS_TO_TICKS(LONG_DELAY_MS));  // 3600000 = 1H
+
+		Sprintln("Updating time using NTP");
+		getLocalTime(&timeinfo, 0);
+	}
+}
+
+#if defined(HEALTH_METRICS)
+void healthTask(void *pvParameters) {
+	for (;;) {
+		vTaskDelay(pdMS_TO_TICKS(HEALTH_INTERVAL_MS));
+
+		// Reports are not worth queueing while the broker is away, they would only push out replies.
+		// The next one carries the outage instead
+		if (client.connected())
+			healthPublish();
+		else {
+			portENTER_CRITICAL(&healthStatsMux);
+			healthStats.missedReports++;
+			portEXIT_CRITICAL(&healthStatsMux);
+		}
+	}
+}
+
+// Compact report to MQTT_PUB_HEALTH, stack values are high-water marks (bytes never used)
+void healthPublish() {
+	StaticJsonDocument<JSON_OBJECT_SIZE(23) + JSON_OBJECT_SIZE(8) + 5 * JSON_ARRAY_SIZE(3) + JSON_ARRAY_SIZE(5) + JSON_ARRAY_SIZE(WORKER_POOL_SIZE)> jsonBuffer;
+	char data[MQTT_PAYLOAD_SIZE];
+
+	portENTER_CRITICAL(&healthStatsMux);
+	healthStatsStruct health = healthStats;
+	healthStats.missedReports = 0;
+	portEXIT_CRITICAL(&healthStatsMux);
+
+	JsonObject rootJSON = jsonBuffer.to<JsonObject>();
+	rootJSON["up"] = millis() / 1000;
+
+	JsonArray heap = rootJSON.createNestedArray("heap");  // free, lowest free, largest block
+	heap.add(ESP.getFreeHeap());
+	heap.add(ESP.getMinFreeHeap());
+	heap.add(ESP.getMaxAllocHeap());
+
+	JsonObject stack = rootJSON.createNestedObject("stack");
+	stack["loop"] = uxTaskGetStackHighWaterMark(loopTaskHandler);
+	stack["icmp"] = uxTaskGetStackHighWaterMark(icmpTaskHandler);
+	stack["icmpRx"] = uxTaskGetStackHighWaterMark(icmpReceiveTaskHandler);
+	stack["ntp"] = uxTaskGetStackHighWaterMark(ntpTaskHandler);
+#if defined(DISCOVERY_SWEEP)
+	stack["discovery"] = uxTaskGetStackHighWaterMark(discoveryTaskHandler);
+#endif
+#if defined(WAKE_SCHEDULER)
+	stack["wakeSched"] = uxTaskGetStackHighWaterMark(wakeSchedulerTaskHandler);
+#endif
+#if defined(SCHEDULED_WAKES)
+	stack["schedule"] = uxTaskGetStackHighWaterMark(scheduleTaskHandler);
+#endif
+#if defined(WORKER_POOL)
+	JsonArray workers = stack.createNestedArray("worker");
+	for (uint8_t i = 0; i < WORKER_POOL_SIZE; i++)
+		workers.add(uxTaskGetStackHighWaterMark(workerTaskHandlers[i]));
+#endif
+
+	JsonArray icmpQ = rootJSON.createNestedArray("icmpQ");  // used, high-water, size
+	xSemaphoreTake(icmpQueueSemaphore, portMAX_DELAY);
+	icmpQ.add(icmpQueueUsed);
+	icmpQ.add(icmpQueueMaxUsed);
+	xSemaphoreGive(icmpQueueSemaphore);
+	icmpQ.add(icmpQueueSize);
+
+	JsonArray mqttQ = rootJSON.createNestedArray("mqttQ");
+	xSemaphoreTake(mqttQueueSemaphore, portMAX_DELAY);
+	mqttQ.add(mqttMessagesQueueCount);
+	mqttQ.add(mqttStats.maxDepth);
+	rootJSON["pubFail"] = mqttStats.failed;
+	rootJSON["pubDrop"] = mqttStats.dropped;
+	xSemaphoreGive(mqttQueueSemaphore);
+	mqttQ.add(mqttMessagesQueueSize);
+
+#if defined(WAKE_SCHEDULER)
+	wakeSchedulerStatsStruct wakeStats = wakeSchedulerGetStats();
+
+	JsonArray wakeQ = rootJSON.createNestedArray("wakeQ");  // waiting for a token, high-water, size
+	wakeQ.add(wakeStats.waiting);
+	wakeQ.add(wakeStats.maxWaiting);
+	wakeQ.add(WAKE_SCHEDULER_QUEUE_SIZE);
+	rootJSON["wakeDrop"] = wakeStats.dropped;
+#endif
+
+	portENTER_CRITICAL(&mqttConnectionMux);
+	mqttConnectionStruct connection = mqttConnection;
+	portEXIT_CRITICAL(&mqttConnectionMux);
+
+	// Only published while connected, an outage shows up in the first report after it:
+	// reports skipped meanwhile and how long the reconnect took
+	rootJSON["missed"] = health.missedReports;
+	rootJSON["mqttState"] = mqttConnStateName(connection.state);
+	rootJSON["stateFor"] = (millis() - connection.since) / 1000;
+	rootJSON["connFail"] = connection.failures;
+	JsonArray reconnect = rootJSON.createNestedArray("reconnect");  // last, longest (ms)
+	reconnect.add(connection.lastReconnectMillis);
+	reconnect.add(connection.maxReconnectMillis);
+
+#if defined(TLS_SESSION_RESUME)
+	tlsSessionStats tls = tlsSessionGetStats();
+	uint32_t full = tls.handshakes - tls.resumed;
+
+	JsonArray tlsJSON = rootJSON.createNestedArray("tls");  // handshakes, resumed, last ms, avg full ms, avg resumed ms
+	tlsJSON.add(tls.handshakes);
+	tlsJSON.add(tls.resumed);
+	tlsJSON.add(tls.lastMillis);
+	tlsJSON.add(full > 0 ? tls.fullMillis / full : 0);
+	tlsJSON.add(tls.resumed > 0 ? tls.resumedMillis / tls.resumed : 0);
+#endif
+
+	rootJSON["mqttErr"] = health.mqttErrors;
+	rootJSON["lastErr"] = (int)health.lastMqttError;
+	rootJSON["mqttConn"] = health.mqttConnects;
+	rootJSON["wifiDrop"] = health.wifiDisconnects;
+
+	portENTER_CRITICAL(&dispatchStatsMux);
+	rootJSON["dropped"] = dispatchStats.dropped;
+	rootJSON["dupes"] = dispatchStats.duplicates;
+	rootJSON["statusDrop"] = dispatchStats.statusDropped;
+	rootJSON["suppressed"] = wakeGuardSuppressed();
+	portEXIT_CRITICAL(&dispatchStatsMux);
+
+	serializeJson(rootJSON, data, sizeof(data));
+	mqttMessageAdd(MQTT_PUB_HEALTH, data);
+}
+#endif
+
+#if defined(DISCOVERY_SWEEP)
+// Walks the local subnet with ARP requests at DISCOVERY_PPS, replies are learned by the etharp_input() wrap
+void discoverySweepTask(void *pvParameters) {
+	uint32_t cursor = 0;
+
+	for (;;) {
+		if (!WiFi.isConnected()) {
+			vTaskDelay(pdMS_TO_TICKS(FAILED_DELAY_MS));
+			continue;
+		}
+
+		IPAddress localIP = WiFi.localIP();
+		IPAddress subnetMask = WiFi.subnetMask();
+		IPAddress networkID = getNetworkID(localIP, subnetMask);
+		uint8_t cidr = subnetCIDR(subnetMask);
+
+		// Associated but no address yet, a /0 would also make the shift below undefined
+		if (cidr == 0 || (uint32_t)localIP == 0) {
+			vTaskDelay(pdMS_TO_TICKS(FAILED_DELAY_MS));
+			continue;
+		}
+
+		uint32_t network = ((uint32_t)networkID[0] << 24) | ((uint32_t)networkID[1] << 16) | ((uint32_t)networkID[2] << 8) | networkID[3];
+		uint32_t hosts = cidr < 31 ? (1UL << (32 - cidr)) - 2 : 0;
+
+		if (cursor >= hosts) {
+			Linfo("Discovery sweep done, %u hosts known", discoveryCount());
+
+			cursor = 0;
+			vTaskDelay(pdMS_TO_TICKS(DISCOVERY_INTERVAL_MS));
+			continue;
+		}
+
+		if (discoveryDeferred()) {
+			vTaskDelay(pdMS_TO_TICKS(DISCOVERY_DEFER_MS));
+			continue;
+		}
+
+		uint32_t target = network + 1 + cursor++;
+		IPAddress address(target >> 24, target >> 16, target >> 8, target);
+
+		if (address != localIP)
+			arpProbeRequest((uint32_t)address);
+
+		vTaskDelay(pdMS_TO_TICKS(1000 / DISCOVERY_PPS));
+	}
+}
+#endif
+
+#if defined(SCHEDULE_RESTART)
+void restartTask(void *pvParameters) {
+	for (;;) {
+		vTaskDelay(pdMS_TO_TICKS(LONG_DELAY_MS));
+
+		if (millis() >= ((unsigned long)SCHEDULE_RESTART_MILLIS * 1000))  // SCHEDULE_RESTART_MILLIS
+			break;
+	}
+
+	prepareRestart();
+	vTaskDelete(NULL);
+}
+#endif
+
+void icmpTask(void *pvParameters) {
+	uint8_t slot;
+	unsigned long deadline;
+	arpFrameStruct frame;
+	announceStruct announce;
+
+	for (;;) {
+		TickType_t wait = portMAX_DELAY;
+		bool resultsReady = false;
+
+		if (!WiFi.isConnected() || !pingEngineOpen()) {
+			vTaskDelay(pdMS_TO_TICKS(FAILED_DELAY_MS));
+			continue;
+		}
+
+		if (xSemaphoreTake(icmpQueueSemaphore, pdMS_TO_TICKS(1000)) == pdTRUE) {
+			unsigned long now = millis();
+
+			while (arpProbeReceive(&frame))
+				icmpArpFrame(&frame);
+
+			while (announceReceive(&announce))
+				icmpAnnounce(&announce);
+
+			while (deadlineHeapPeek(&icmpSchedule, &slot, &deadline) && deadlineReached(deadline, now)) {
+				if (icmpQueue[slot].state == ICMP_WAITING)
+					icmpSendProbe(slot);
+				else if (icmpQueue[slot].state == ICMP_IN_FLIGHT)
+					icmpProbeTimeout(slot);
+				else
+					deadlineHeapRemove(&icmpSchedule, slot);
+			}
+
+			if (deadlineHeapPeek(&icmpSchedule, &slot, &deadline))
+				wait = pdMS_TO_TICKS(deadline - now) + 1;
+
+			resultsReady = icmpResultsPending > 0;
+
+			xSemaphoreGive(icmpQueueSemaphore);
+		}
+
+		if (resultsReady == true) {
+			icmpPublishResults();
+			continue;
+		}
+
+		// Sleep until the earliest deadline, or until icmpRequstAdd()/an echo reply/an ARP frame notifies us
+		ulTaskNotifyTake(pdTRUE, wait);
+	}
+}
+
+void icmpReceiveTask(void *pvParameters) {
+	uint32_t replyIP;
+	uint16_t replySequence;
+
+	for (;;) {
+		if (!pingEngineReady()) {
+			vTaskDelay(pdMS_TO_TICKS(FAILED_DELAY_MS));
+			continue;
+		}
+
+		if (pingEngineReceive(PING_ENGINE_WAIT_FOREVER, &replyIP, &replySequence))
+			icmpEchoReply(replyIP, replySequence);
+	}
+}
+
+// Caller must hold icmpQueueSemaphore
+void icmpSendProbe(uint8_t slot) {
+	icmpQueueStruct *entry = &icmpQueue[slot];
+
+	// No IP given and not learned yet, a booting host usually announces itself before the next try
+	if ((uint32_t)entry->ip == 0 && !icmpResolve(slot)) {
+		uint32_t delay = icmpRetryDelay(slot);
+
+		Ldebug("> unresolved host");
+
+		if (delay == 0)
+			icmpComplete(slot, false);
+		else
+			deadlineHeapSet(&icmpSchedule, slot, millis() + delay);
+		return;
+	}
+
+	if (entry->probe == PROBE_ARP) {
+		Ldebug("> arp %u.%u.%u.%u", LOG_IP(entry->ip));
+
+		if (!arpProbeSend((uint32_t)entry->ip))
+			Lwarn("ARP send failed");
+
+		entry->state = ICMP_IN_FLIGHT;
+		entry->sentMicros = micros();
+
+		deadlineHeapSet(&icmpSchedule, slot, millis() + ARP_TIMEOUT_MS);
+		return;
+	}
+
+	// Slot in the high byte, per-entry counter in the low byte: a late reply to an older echo never matches
+	entry->sequence = (slot << 8) | (uint8_t)(entry->sequence + 1);
+
+	Ldebug("> ping %u.%u.%u.%u", LOG_IP(entry->ip));
+
+	if (!pingEngineSend(entry->ip, entry->sequence))
+		Lwarn("ICMP send failed");
+
+	entry->state = ICMP_IN_FLIGHT;
+	entry->sentMicros = micros();
+
+	deadlineHeapSet(&icmpSchedule, slot, millis() + PING_TIMEOUT_MS);
+}
+
+// Caller must hold icmpQueueSemaphore
+void icmpProbeTimeout(uint8_t slot) {
+	icmpQueueStruct *entry = &icmpQueue[slot];
+
+	entry->state = ICMP_WAITING;
+
+	if (--entry->echoesLeft > 0) {
+		deadlineHeapSet(&icmpSchedule, slot, millis());
+		return;
+	}
+
+	// PROBE_AUTO: no ARP answer within this try, fall back to ICMP right away
+	if (entry->probe == PROBE_ARP && entry->method == PROBE_AUTO) {
+		entry->probe = PROBE_ICMP;
+		entry->echoesLeft = PING_ECHO_COUNT;
+
+		deadlineHeapSet(&icmpSchedule, slot, millis());
+		return;
+	}
+
+	uint32_t delay = icmpRetryDelay(slot);
+
+	Linfo(">> timeout %u.%u.%u.%u next try in %ums", LOG_IP(entry->ip), delay);
+
+	if (delay == 0)
+		icmpComplete(slot, false);
+	else
+		deadlineHeapSet(&icmpSchedule, slot, millis() + delay);
+}
+
+// A try went unanswered: time until the next one, 0 to give up. With a learned boot window
+// tries are sparse before it, every BOOT_MODEL_DENSE_MS inside and sparse again for BOOT_MODEL_GRACE_MS after.
+// Caller must hold icmpQueueSemaphore
+uint32_t icmpRetryDelay(uint8_t slot) {
+	icmpQueueStruct *entry = &icmpQueue[slot];
+	uint32_t elapsed = millis() - entry->startedAt;
+
+	entry->missed = true;
+	entry->tries--;
+	icmpStartTry(slot);
+
+	if (entry->windowEnd == 0)
+		return entry->tries > 0 ? PING_BETWEEN_DELAY_MS : 0;
+
+	if (elapsed < entry->windowStart)
+		return min(entry->windowStart - elapsed, (uint32_t)PING_BETWEEN_DELAY_MS);
+
+	if (elapsed < entry->windowEnd)
+		return BOOT_MODEL_DENSE_MS;
+
+	if (elapsed < entry->windowEnd + BOOT_MODEL_GRACE_MS)
+		return PING_BETWEEN_DELAY_MS;
+
+	return 0;
+}
+
+// Caller must hold icmpQueueSemaphore
+void icmpStartTry(uint8_t slot) {
+	icmpQueueStruct *entry = &icmpQueue[slot];
+
+	entry->probe = entry->method == PROBE_ICMP ? PROBE_ICMP : PROBE_ARP;
+	entry->echoesLeft = entry->probe == PROBE_ARP ? ARP_PROBE_COUNT : PING_ECHO_COUNT;
+}
+
+// A request for a host already being checked gets the same result instead of a second cycle.
+// Caller must hold icmpQueueSemaphore
+void icmpAttach(uint8_t slot, const char *topic, messageFormat format, uint16_t traceId) {
+	icmpQueueStruct *entry = &icmpQueue[slot];
+
+	if (entry->format == format && strcmp(entry->topic, topic) == 0)
+		return;
+
+	for (uint8_t i = 0; i < entry->attached; i++) {
+		if (entry->attachedReplies[i].format == format && strcmp(entry->attachedReplies[i].topic, topic) == 0)
+			return;
+	}
+
+	if (entry->attached == ICMP_ATTACH_MAX) {
+		Lwarn("[%s] status reply not attached, %u already", logText(topic), entry->attached);
+		return;
+	}
+
+	icmpReplyStruct *reply = &entry->attachedReplies[entry->attached++];
+
+	strlcpy(reply->topic, topic, TOPIC_SIZE);
+	reply->format = format;
+	reply->traceId = traceId;
+}
+
+// Caller must hold icmpQueueSemaphore
+bool icmpResolve(uint8_t slot) {
+	uint32_t ip;
+
+	if (!discoveryLookup(icmpQueue[slot].mac, &ip))
+		return false;
+
+	icmpQueue[slot].ip = ip;
+	return true;
+}
+
+// Caller must hold icmpQueueSemaphore
+void icmpComplete(uint8_t slot, bool result) {
+	icmpQueue[slot].result = result;
+	icmpQueue[slot].state = ICMP_DONE;
+	icmpQueue[slot].elapsedMillis = millis() - icmpQueue[slot].startedAt;
+
+	if (icmpQueue[slot].method != PROBE_ICMP)
+		arpProbeUnwatch((uint32_t)icmpQueue[slot].ip);
+
+#if defined(ANNOUNCE_LISTEN)
+	if (icmpQueue[slot].afterWake)
+		announceUnwatch(icmpQueue[slot].mac);
+#endif
+
+	deadlineHeapRemove(&icmpSchedule, slot);
+	icmpResultsPending++;
+}
+
+// Any ARP frame from the host counts, including gratuitous ARP sent while it boots between tries.
+// Caller must hold icmpQueueSemaphore
+void icmpArpFrame(const arpFrameStruct *frame) {
+	for (uint8_t i = 0; i < icmpQueueSize; i++) {
+		icmpQueueStruct *entry = &icmpQueue[i];
+
+		if ((entry->state != ICMP_WAITING && entry->state != ICMP_IN_FLIGHT) || entry->method == PROBE_ICMP || (uint32_t)entry->ip != frame->ip)
+			continue;
+
+		entry->rttMicros = (entry->state == ICMP_IN_FLIGHT && entry->probe == PROBE_ARP) ? micros() - entry->sentMicros : 0;
+		entry->probe = PROBE_ARP;
+		icmpComplete(i, true);
+		traceMark(entry->traceId, TRACE_CONFIRMED);
+
+		Linfo(">> arp reply %u.%u.%u.%u %uus", LOG_IP(entry->ip), entry->rttMicros);
+	}
+}
+
+// A waking host announcing itself is up, even with its IP unknown or ICMP blocked.
+// Caller must hold icmpQueueSemaphore
+void icmpAnnounce(const announceStruct *announce) {
+	for (uint8_t i = 0; i < icmpQueueSize; i++) {
+		icmpQueueStruct *entry = &icmpQueue[i];
+
+		if ((entry->state != ICMP_WAITING && entry->state != ICMP_IN_FLIGHT) || !entry->afterWake || memcmp(entry->mac, announce->mac, MAC_ADDRESS_SIZE) != 0)
+			continue;
+
+		if ((uint32_t)entry->ip == 0)
+			entry->ip = announce->ip;
+
+		entry->rttMicros = 0;
+		entry->probe = PROBE_ANNOUNCE;
+		icmpComplete(i, true);
+		traceMark(entry->traceId, TRACE_CONFIRMED);
+
+		Linfo(">> %s announce %u.%u.%u.%u", announce->source == ANNOUNCE_DHCP ? "dhcp" : "arp", LOG_IP(entry->ip));
+	}
+}
+
+void icmpEchoReply(uint32_t ip, uint16_t sequence) {
+	uint8_t slot = sequence >> 8;
+	uint32_t rttMicros;
+	bool matched = false;
+
+	if (slot >= icmpQueueSize)
+		return;
+
+	if (xSemaphoreTake(icmpQueueSemaphore, pdMS_TO_TICKS(1000)) == pdFALSE)
+		return;
+
+	icmpQueueStruct *entry = &icmpQueue[slot];
+
+	if (entry->state == ICMP_IN_FLIGHT && entry->probe == PROBE_ICMP && entry->sequence == sequence && (uint32_t)entry->ip == ip) {
+		entry->rttMicros = micros() - entry->sentMicros;
+		icmpComplete(slot, true);
+		traceMark(entry->traceId, TRACE_CONFIRMED);
+
+		// The slot can be reused as soon as the lock is given back
+		rttMicros = entry->rttMicros;
+		matched = true;
+	}
+
+	xSemaphoreGive(icmpQueueSemaphore);
+
+	if (matched) {
+		Linfo(">> reply %u.%u.%u.%u %uus", LOG_IP(IPAddress(ip)), rttMicros);
+
+		xTaskNotifyGive(icmpTaskHandler);
+	}
+}
+
+// Entries in ICMP_DONE are only touched by icmpTask, so they are read here without the lock
+void icmpPublishResults() {
+	for (uint8_t i = 0; i < icmpQueueSize; i++) {
+		if (icmpQueue[i].state != ICMP_DONE)
+			continue;
+
+		addDeviceStatus(icmpQueue[i].mac, icmpQueue[i].topic, icmpQueue[i].format, icmpQueue[i].result, icmpQueue[i].probe, icmpQueue[i].rttMicros, icmpQueue[i].elapsedMillis, icmpQueue[i].traceId);
+
+		for (uint8_t j = 0; j < icmpQueue[i].attached; j++) {
+			icmpReplyStruct *reply = &icmpQueue[i].attachedReplies[j];
+
+			addDeviceStatus(icmpQueue[i].mac, reply->topic, reply->format, icmpQueue[i].result, icmpQueue[i].probe, icmpQueue[i].rttMicros, icmpQueue[i].elapsedMillis, reply->traceId);
+		}
+
+#if defined(BOOT_MODEL)
+		// Only hosts seen offline first tell how long a boot takes
+		if (icmpQueue[i].result && icmpQueue[i].afterWake && icmpQueue[i].missed)
+			bootModelLearn(icmpQueue[i].mac, icmpQueue[i].elapsedMillis);
+#endif
+
+		xSemaphoreTake(icmpQueueSemaphore, portMAX_DELAY);
+		icmpQueue[i].state = ICMP_IDLE;
+		icmpResultsPending--;
+		icmpQueueUsed--;
+		xSemaphoreGive(icmpQueueSemaphore);
+	}
+}
+
+// Never blocks on a full queue: the check is refused (and counted) with a PROBE_BUSY reply
+// rather than stalling the worker or wake scheduler task that asked for it
+bool icmpRequstAdd(const uint8_t *mac, IPAddress ip, const char *topic, messageFormat format, probeMethod method, bool afterWake, uint16_t traceId) {
+	bool addedToQueue = false;
+
+	if (xSemaphoreTake(icmpQueueSemaphore, pdMS_TO_TICKS(1000)) == pdTRUE) {
+		addedToQueue = icmpQueueInsert(mac, ip, topic, format, method, afterWake, traceId);
+
+		xSemaphoreGive(icmpQueueSemaphore);
+
+		if (!addedToQueue)
+			Lwarn("ICMP queue full (%u slots), status check dropped", icmpQueueSize);
+	} else
+		Lwarn("ICMP queue lock timed out, status check dropped");
+
+	if (addedToQueue) {
+		xTaskNotifyGive(icmpTaskHandler);
+		return true;
+	}
+
+	portENTER_CRITICAL(&dispatchStatsMux);
+	dispatchStats.statusDropped++;
+	portEXIT_CRITICAL(&dispatchStatsMux);
+
+	if (topic[0] != '\0')
+		addDeviceStatus(mac, topic, format, false, PROBE_BUSY, 0, 0, traceId);
+
+	return false;
+}
+
+// Status checks after a wake retry up to PING_RETRY_NUM times (or around the learned boot window), plain ones try once.
+// Caller must hold icmpQueueSemaphore
+bool icmpQueueInsert(const uint8_t *mac, IPAddress ip, const char *topic, messageFormat format, probeMethod method, bool afterWake, uint16_t traceId) {
+	// ARP does not cross routers, unresolved hosts are resolved from the (local) discovery table
+	if (method != PROBE_ICMP && (uint32_t)ip != 0 && !onLocalSubnet(ip))
+		method = PROBE_ICMP;
+
+	// The whole queue first, a check for the same host may sit behind an idle slot
+	for (uint8_t i = 0; i < icmpQueueSize; i++) {
+		if ((icmpQueue[i].state == ICMP_WAITING || icmpQueue[i].state == ICMP_IN_FLIGHT) && (memcmp(icmpQueue[i].mac, mac, MAC_ADDRESS_SIZE) == 0 || ((uint32_t)ip != 0 && icmpQueue[i].ip == ip))) {
+			icmpAttach(i, topic, format, traceId);
+			return true;
+		}
+	}
+
+	for (uint8_t i = 0; i < icmpQueueSize; i++) {
+		if (icmpQueue[i].state == ICMP_IDLE) {
+			icmpQueue[i].state = ICMP_WAITING;
+
+			if (++icmpQueueUsed > icmpQueueMaxUsed)
+				icmpQueueMaxUsed = icmpQueueUsed;
+
+			memcpy(icmpQueue[i].mac, mac, MAC_ADDRESS_SIZE);
+			icmpQueue[i].ip = ip;
+
+			strlcpy(icmpQueue[i].topic, topic, TOPIC_SIZE);
+			icmpQueue[i].format = format;
+
+			icmpQueue[i].method = method;
+			icmpQueue[i].tries = afterWake ? PING_RETRY_NUM : 1;
+			icmpQueue[i].startedAt = millis();
+			icmpQueue[i].traceId = traceId;
+			icmpStartTry(i);
+
+			icmpQueue[i].afterWake = afterWake;
+			icmpQueue[i].missed = false;
+			icmpQueue[i].attached = 0;
+			icmpQueue[i].windowStart = 0;
+			icmpQueue[i].windowEnd = 0;
+
+#if defined(ANNOUNCE_LISTEN)
+			if (afterWake && !announceWatch(mac))
+				Lwarn("announce watch full");
+#endif
+
+#if defined(BOOT_MODEL)
+			uint32_t mean, deviation;
+
+			if (afterWake && bootModelGet(mac, &mean, &deviation)) {
+				uint32_t halfWindow = max(2 * deviation, (uint32_t)BOOT_MODEL_MIN_WINDOW_MS);
+
+				icmpQueue[i].windowStart = mean > halfWindow ? mean - halfWindow : 0;
+				icmpQueue[i].windowEnd = mean + halfWindow;
+			}
+#endif
+
+			deadlineHeapSet(&icmpSchedule, i, millis());
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool onLocalSubnet(IPAddress ip) {
+	IPAddress subnetMask = WiFi.subnetMask();
+
+	return getNetworkID(ip, subnetMask) == getNetworkID(WiFi.localIP(), subnetMask);
+}
+
+void addDeviceStatus(const uint8_t *mac, const char *topic, messageFormat format, bool status, probeMethod method, uint32_t rttMicros, uint32_t elapsedMillis, uint16_t traceId) {
+	char data[MQTT_PAYLOAD_SIZE];
+	uint16_t traceIds[STATUS_COALESCE_MAX];
+	uint8_t traceCount = 0;
+	size_t length = 0;
+	bool flushNow = false;
+	int8_t slot = -1;
+
+	xSemaphoreTake(statusCoalesceSemaphore, portMAX_DELAY);
+
+	for (uint8_t i = 0; i < STATUS_COALESCE_SLOTS && slot < 0; i++) {
+		if (statusCoalesce[i].count > 0 && statusCoalesce[i].format == format && strcmp(statusCoalesce[i].topic, topic) == 0)
+			slot = i;
+	}
+
+	for (uint8_t i = 0; i < STATUS_COALESCE_SLOTS && slot < 0; i++) {
+		if (statusCoalesce[i].count == 0) {
+			strlcpy(statusCoalesce[i].topic, topic, TOPIC_SIZE);
+			statusCoalesce[i].format = format;
+			statusCoalesce[i].openedAt = millis();
+			slot = i;
+		}
+	}
+
+	if (slot >= 0) {
+		statusCoalesceStruct *batch = &statusCoalesce[slot];
+		statusResultStruct *result = &batch->results[batch->count++];
+
+		memcpy(result->mac, mac, MAC_ADDRESS_SIZE);
+		result->status = status;
+		result->method = method;
+		result->rttMicros = rttMicros;
+		result->elapsedMillis = elapsedMillis;
+		result->traceId = traceId;
+
+		flushNow = (batch->count == STATUS_COALESCE_MAX || STATUS_COALESCE_MS == 0);
+		if (flushNow)
+			length = statusCoalesceSerialize(batch, data, sizeof(data), traceIds, &traceCount);
+	}
+
+	xSemaphoreGive(statusCoalesceSemaphore);
+
+	if (slot < 0) {
+		// Every slot is busy with another topic, send this one on its own
+		statusCoalesceStruct single;
+		single.format = format;
+		single.count = 1;
+
+		memcpy(single.results[0].mac, mac, MAC_ADDRESS_SIZE);
+		single.results[0].status = status;
+		single.results[0].method = method;
+		single.results[0].rttMicros = rttMicros;
+		single.results[0].elapsedMillis = elapsedMillis;
+		single.results[0].traceId = traceId;
+
+		length = statusCoalesceSerialize(&single, data, sizeof(data), traceIds, &traceCount);
+		mqttMessageAdd(topic, (const uint8_t *)data, length, traceIds, traceCount);
+	} else if (flushNow)
+		mqttMessageAdd(topic, (const uint8_t *)data, length, traceIds, traceCount);
+}
+
+// Publishes every batch whose window has elapsed (or all of them when force is set)
+void statusCoalesceFlush(bool force) {
+	char topic[TOPIC_SIZE];
+	char data[MQTT_PAYLOAD_SIZE];
+	uint16_t traceIds[STATUS_COALESCE_MAX];
+	uint8_t traceCount, remaining;
+	size_t length;
+
+	for (uint8_t i = 0; i < STATUS_COALESCE_SLOTS; i++) {
+		bool ready = false;
+
+		xSemaphoreTake(statusCoalesceSemaphore, portMAX_DELAY);
+
+		if (statusCoalesce[i].count > 0 && (force || deadlineReached(statusCoalesce[i].openedAt + STATUS_COALESCE_MS, millis()))) {
+			strlcpy(topic, statusCoalesce[i].topic, TOPIC_SIZE);
+			length = statusCoalesceSerialize(&statusCoalesce[i], data, sizeof(data), traceIds, &traceCount);
+			remaining = statusCoalesce[i].count;
+			ready = true;
+		}
+
+		xSemaphoreGive(statusCoalesceSemaphore);
+
+		if (ready) {
+			mqttMessageAdd(topic, (const uint8_t *)data, length, traceIds, traceCount);
+
+			// A batch larger than one payload goes out in parts
+			if (remaining > 0)
+				i--;
+		}
+	}
+}
+
+bool mqttMessageAdd(const char *topic, const char *payload) {
+	return mqttMessageAdd(topic, (const uint8_t *)payload, strlen(payload));
+}
+
+// Never blocks on a full queue: during an outage the newest message is dropped (and counted)
+// rather than stalling the worker, ICMP or health task that produced it
+bool mqttMessageAdd(const char *topic, const uint8_t *payload, size_t length, const uint16_t *traceIds, uint8_t traceCount) {
+	bool addedToQueue = false;
+
+	if (length > MQTT_PAYLOAD_SIZE)
+		length = MQTT_PAYLOAD_SIZE;
+
+	if (xSemaphoreTake(mqttQueueSemaphore, pdMS_TO_TICKS(1000)) == pdTRUE) {
+		if (mqttMessagesQueueCount < mqttMessagesQueueSize) {
+			mqttMessageStruct *message = &mqttMessagesQueue[(mqttMessagesQueueHead + mqttMessagesQueueCount) % mqttMessagesQueueSize];
+
+			strlcpy(message->topic, topic, TOPIC_SIZE);
+			memcpy(message->payload, payload, length);
+			message->length = length;
+
+			message->traceCount = min(traceCount, (uint8_t)STATUS_COALESCE_MAX);
+			if (message->traceCount > 0)
+				memcpy(message->traceIds, traceIds, message->traceCount * sizeof(uint16_t));
+
+			message->queuedMicros = micros();
+			message->nextTry = millis();
+			message->retries = 0;
+
+			mqttMessagesQueueCount++;
+			if (mqttMessagesQueueCount > mqttStats.maxDepth)
+				mqttStats.maxDepth = mqttMessagesQueueCount;
+
+			addedToQueue = true;
+		} else
+			mqttStats.dropped++;
+
+		xSemaphoreGive(mqttQueueSemaphore);
+	}
+
+	if (!addedToQueue)
+		Lwarn("[%s] MQTT queue full, %u bytes dropped", logText(topic), length);
+
+	return addedToQueue;
+}
+
+// One message per stage to MQTT_PUB_METRICS, bounds and buckets as in tracing.h
+void latencyMetricsPublish(bool reset) {
+	char data[MQTT_PAYLOAD_SIZE];
+
+	for (uint8_t stage = 0; stage < TRACE_STAGES; stage++) {
+		StaticJsonDocument<JSON_OBJECT_SIZE(6) + JSON_ARRAY_SIZE(TRACE_BUCKETS - 1) + JSON_ARRAY_SIZE(TRACE_BUCKETS)> jsonBuffer;
+		traceHistogramStruct histogram;
+
+		traceHistogram((traceStage)stage, &histogram);
+
+		JsonObject rootJSON = jsonBuffer.to<JsonObject>();
+		rootJSON["id"] = 6;
+		rootJSON["stage"] = traceStageName((traceStage)stage);
+		rootJSON["count"] = histogram.count;
+		rootJSON["max"] = histogram.maxMicros;
+
+		JsonArray bounds = rootJSON.createNestedArray("bounds");  // us
+		for (uint8_t i = 0; i < TRACE_BUCKETS - 1; i++)
+			bounds.add(traceBucketBounds[i]);
+
+		JsonArray buckets = rootJSON.createNestedArray("buckets");
+		for (uint8_t i = 0; i < TRACE_BUCKETS; i++)
+			buckets.add(histogram.buckets[i]);
+
+		serializeJson(rootJSON, data, sizeof(data));
+		mqttMessageAdd(MQTT_PUB_METRICS, data);
+	}
+
+	if (reset)
+		traceReset();
+}
+
+void prepareRestart() {
+	Sprint("prepareRestart()");
+
+	if (client.connected()) {
+		client.unsubscribe(AWS_WAKE_CHANNEL);
+		client.unsubscribe(AWS_WAKE_CHANNEL_BINARY);
+		client.disconnect();
+	}
+	if (WiFi.isConnected())
+		WiFi.disconnect();
+
+	esp_restart();
+}
+
+void lwMQTTErr(lwmqtt_err_t reason) {
+	healthMqttError(reason);
+
+	Sprint(lwMQTTErrName(reason));
+}
+
+void healthMqttError(lwmqtt_err_t reason) {
+	portENTER_CRITICAL(&healthStatsMux);
+	healthStats.mqttErrors++;
+	healthStats.lastMqttError = reason;
+	portEXIT_CRITICAL(&healthStatsMux);
+}
+
+// Static strings, safe for deferred logging
+const char *lwMQTTErrName(lwmqtt_err_t reason) {
+	if (reason == lwmqtt_err_t::LWMQTT_SUCCESS)
+		return "Success";
+	else if (reason == lwmqtt_err_t::LWMQTT_BUFFER_TOO_SHORT)
+		return "Buffer too short";
+	else if (reason == lwmqtt_err_t::LWMQTT_VARNUM_OVERFLOW)
+		return "Varnum overflow";
+	else if (reason == lwmqtt_err_t::LWMQTT_NETWORK_FAILED_CONNECT)
+		return "Network failed connect";
+	else if (reason == lwmqtt_err_t::LWMQTT_NETWORK_TIMEOUT)
+		return "Network timeout";
+	else if (reason == lwmqtt_err_t::LWMQTT_NETWORK_FAILED_READ)
+		return "Network failed read";
+	else if (reason == lwmqtt_err_t::LWMQTT_NETWORK_FAILED_WRITE)
+		return "Network failed write";
+	else if (reason == lwmqtt_err_t::LWMQTT_REMAINING_LENGTH_OVERFLOW)
+		return "Remaining length overflow";
+	else if (reason == lwmqtt_err_t::LWMQTT_REMAINING_LENGTH_MISMATCH)
+		return "Remaining length mismatch";
+	else if (reason == lwmqtt_err_t::LWMQTT_MISSING_OR_WRONG_PACKET)
+		return "Missing or wrong packet";
+	else if (reason == lwmqtt_err_t::LWMQTT_CONNECTION_DENIED)
+		return "Connection denied";
+	else if (reason == lwmqtt_err_t::LWMQTT_FAILED_SUBSCRIPTION)
+		return "Failed subscription";
+	else if (reason == lwmqtt_err_t::LWMQTT_SUBACK_ARRAY_OVERFLOW)
+		return "Suback array overflow";
+	else if (reason == lwmqtt_err_t::LWMQTT_PONG_TIMEOUT)
+		return "Pong timeout";
+
+	return "Unknown error";
+}
+
+void lwMQTTErrConnection(lwmqtt_return_code_t reason) {
+	if (reason == lwmqtt_return_code_t::LWMQTT_CONNECTION_ACCEPTED)
+		Sprint("Connection Accepted");
+	else if (reason == lwmqtt_return_code_t::LWMQTT_UNACCEPTABLE_PROTOCOL)
+		Sprint("Unacceptable Protocol");
+	else if (reason == lwmqtt_return_code_t::LWMQTT_IDENTIFIER_REJECTED)
+		Sprint("Identifier Rejected");
+	else if (reason == lwmqtt_return_code_t::LWMQTT_SERVER_UNAVAILABLE)
+		Sprint("Server Unavailable");
+	else if (reason == lwmqtt_return_code_t::LWMQTT_BAD_USERNAME_OR_PASSWORD)
+		Sprint("Bad UserName/Password");
+	else if (reason == lwmqtt_return_code_t::LWMQTT_NOT_AUTHORIZED)
+		Sprint("Not Authorized");
+	else if (reason == lwmqtt_return_code_t::LWMQTT_UNKNOWN_RETURN_CODE)
+		Sprint("Unknown Return Code");
+}
+
+IPAddress getNetworkID(IPAddress ip, IPAddress subnet) {
+	IPAddress networkID;
+
+	for (size_t i = 0; i < 4; i++)
+		networkID[i] = subnet[i] & ip[i];
+
+	return networkID;
+}
+
+IPAddress getBroadcastAddress(IPAddress ip, IPAddress subnet) {
+	IPAddress broadcast;
+
+	for (size_t i = 0; i < 4; i++)
+		broadcast[i] = ip[i] | ~subnet[i];
+
+	return broadcast;
 }
 
 uint8_t subnetCIDR(IPAddress subnetMask) {
@@ -23,6 +23,7 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 
 #include <Ticker.h>
 #include <esp_system.h>
@@ -37,8 +38,25 @@
 #include "Credentials.h"
 #include "settings.h"
 
-#include <ESP32Ping.h>
-#include <WakeOnLan.h>
+#include "alloctrace.h"
+#include "announce.h"
+#include "arpprobe.h"
+#include "bootmodel.h"
+#include "deadlineheap.h"
+#include "dedup.h"
+#include "discovery.h"
+#include "jsonformat.h"
+#include "logger.h"
+#include "magicpacket.h"
+#include "messages.h"
+#include "pingengine.h"
+#include "registry.h"
+#include "schedule.h"
+#include "tlssession.h"
+#include "tracing.h"
+#include "wakeguard.h"
+#include "wakescheduler.h"
+#include "wireformat.h"
 
 void setupTasks();
 
@@ -49,31 +67,104 @@ void wifiDisconnected(system_event_id_t event);
 
 void updateSystemTime();
 
+enum mqttConnState : uint8_t;
+
 void connectToAWS();
-void messageReceived(String &topic, String &payload);
+void mqttConnectionProcess();
+void mqttConnectionSet(mqttConnState state);
+const char *mqttConnStateName(mqttConnState state);
+void messageReceived(MQTTClient *mqttClient, char topic[], char bytes[], int length);
+bool binaryMessageReceived(const uint8_t *data, size_t length, unsigned long receivedMicros);
 void mqttMessageQueueProcess();
+uint32_t mqttBackoff(uint8_t retries, uint32_t baseMs, uint32_t maxMs);
 void sendShadowData(void);
 
-void wakeDeviceTask(void *pvParameters);
-void deviceStatusTask(void *pvParameters);
+void registryCommand(JsonObject obj);
+#if defined(SCHEDULED_WAKES)
+void scheduleCommand(JsonObject obj);
+void scheduleTask(void *pvParameters);
+void scheduleFire(uint8_t id, time_t now);
+#endif
+bool messageDuplicate();
+void messageRecord();
+bool requestDuplicate(JsonVariant rid);
+void requestRecord(JsonVariant rid);
+bool requestKey(JsonVariant rid, uint32_t *key);
+
+bool sendMagicPacket(const uint8_t *mac, const uint8_t *secureOn, uint16_t port, const wakeTargetStruct *target);
+uint32_t wakeTargetAcquire(const uint8_t *mac, const wakeTargetStruct *target, bool *staticArp);
+
+void wakeDevice(struct wakeMessageStruct *device, uint16_t traceId);
+void wakeSend(struct wakeMessageStruct *device, uint16_t traceId);
+#if defined(WAKE_SCHEDULER)
+void wakeQueuedReply(const struct wakeMessageStruct *device, uint8_t position, uint32_t etaMillis, uint16_t traceId);
+void wakeSchedulerTask(void *pvParameters);
+#endif
+void deviceStatus(struct statusMessageStruct *status, uint16_t traceId);
+void wakeBatch(struct wakeBatchStruct *batch, uint16_t traceId);
+
+bool dispatchJob(struct jobStruct &job);
+void runJob(struct jobStruct *job);
+
+#if defined(WORKER_POOL)
+void workerTask(void *pvParameters);
+#else
+void jobTask(void *pvParameters);
+#endif
+
+struct wakeBatchStruct *wakeBatchAcquire();
+void wakeBatchRelease(struct wakeBatchStruct *batch);
+
+void dispatchStatsRecord(unsigned long receivedMicros);
 
 void ntpTask(void *pvParameters);
 
+#if defined(HEALTH_METRICS)
+void healthTask(void *pvParameters);
+void healthPublish();
+#endif
+
+#if defined(DISCOVERY_SWEEP)
+void discoverySweepTask(void *pvParameters);
+#endif
+
 #if defined(SCHEDULE_RESTART)
 void restartTask(void *pvParameters);
 #endif
 
 void icmpTask(void *pvParameters) ;
-void icmpRequstAdd(String &mac, IPAddress ip, String &topic, uint8_t maxTries);
-
-void addDeviceStatus(String &mac, String &topic, bool status);
+void icmpReceiveTask(void *pvParameters);
+void icmpSendProbe(uint8_t slot);
+void icmpProbeTimeout(uint8_t slot);
+void icmpStartTry(uint8_t slot);
+void icmpAttach(uint8_t slot, const char *topic, messageFormat format, uint16_t traceId);
+uint32_t icmpRetryDelay(uint8_t slot);
+bool icmpResolve(uint8_t slot);
+void icmpComplete(uint8_t slot, bool result);
+void icmpEchoReply(uint32_t ip, uint16_t sequence);
+void icmpArpFrame(const arpFrameStruct *frame);
+void icmpAnnounce(const announceStruct *announce);
+void icmpPublishResults();
+bool icmpRequstAdd(const uint8_t *mac, IPAddress ip, const char *topic, messageFormat format, probeMethod method, bool afterWake, uint16_t traceId);
+bool icmpQueueInsert(const uint8_t *mac, IPAddress ip, const char *topic, messageFormat format, probeMethod method, bool afterWake, uint16_t traceId);
+bool onLocalSubnet(IPAddress ip);
+
+void addDeviceStatus(const uint8_t *mac, const char *topic, messageFormat format, bool status, probeMethod method = PROBE_ICMP, uint32_t rttMicros = 0, uint32_t elapsedMillis = 0, uint16_t traceId = TRACE_NONE);
+void statusCoalesceFlush(bool force);
+bool mqttMessageAdd(const char *topic, const char *payload);
+bool mqttMessageAdd(const char *topic, const uint8_t *payload, size_t length, const uint16_t *traceIds = NULL, uint8_t traceCount = 0);
+
+void latencyMetricsPublish(bool reset);
 
 void prepareRestart();
 
 void lwMQTTErr(lwmqtt_err_t reason);
+const char *lwMQTTErrName(lwmqtt_err_t reason);
+void healthMqttError(lwmqtt_err_t reason);
 void lwMQTTErrConnection(lwmqtt_return_code_t reason);
 
 IPAddress getNetworkID(IPAddress ip, IPAddress subnet);
+IPAddress getBroadcastAddress(IPAddress ip, IPAddress subnet);
 uint8_t subnetCIDR(IPAddress subnetMask);
 
 #ifdef ENABLE_LED
@@ -90,64 +181,218 @@ extern void ledBlinkDuration(float onTime = 1, float offTime = 1);
 #endif
 #endif
 
-struct wakeMessageStruct {
-	String mac;
-	uint16_t port = 9;
+enum jobType : uint8_t {
+	JOB_WAKE = 1,
+	JOB_STATUS = 2,
+	JOB_WAKE_BATCH = 3
+};
 
-	bool retrieveStatus = false;
-	String topic;
-	String ip;
+struct jobStruct {
+	jobType type;
+	unsigned long receivedMicros;
+	uint16_t traceId;
 
-	bool secureOn = false;
-	String secureOnPassword;
+	union {
+		wakeMessageStruct wake;
+		statusMessageStruct status;
+		wakeBatchStruct *batch;
+	};
 };
 
-struct statusMessageStruct {
-	String mac;
-	String topic;
-	String ip;
+struct dispatchStatsStruct {
+	uint32_t requests = 0;
+	uint32_t dropped = 0;
+	uint32_t duplicates = 0;  // redelivered requests acknowledged without running them
+	uint32_t statusDropped = 0;  // status checks refused, the ICMP queue was full
+
+	uint64_t totalLatencyMicros = 0;
+	uint32_t maxLatencyMicros = 0;
+
+	uint32_t baselineFreeHeap = 0;
+	uint32_t lowestFreeHeap = UINT32_MAX;
+
+	uint32_t parsedMessages = 0;
+	uint32_t parseAllocations = 0;  // heap allocations seen inside messageReceived()
+};
+
+// Where a status result goes
+struct icmpReplyStruct {
+	char topic[TOPIC_SIZE];
+	messageFormat format;
+	uint16_t traceId;
+};
+
+enum icmpState : uint8_t {
+	ICMP_IDLE = 0,
+	ICMP_WAITING,    // next probe due at its icmpSchedule deadline
+	ICMP_IN_FLIGHT,  // echo or ARP request sent, reply or timeout (icmpSchedule deadline) pending
+	ICMP_DONE        // result ready to publish
 };
 
 struct icmpQueueStruct {
-	bool waiting = false;
+	icmpState state = ICMP_IDLE;
 
-	String mac;
+	uint8_t mac[MAC_ADDRESS_SIZE];
 	IPAddress ip;
 
-	String topic;
+	char topic[TOPIC_SIZE];
+	messageFormat format = FORMAT_JSON;
+
+	probeMethod method = PROBE_ICMP;  // as requested, PROBE_AUTO steps from ARP to ICMP within each try
+	probeMethod probe = PROBE_ICMP;   // method of the probe in flight
 
 	int8_t tries = 1;
+	uint8_t echoesLeft = PING_ECHO_COUNT;
+	unsigned long startedAt = 0;
+
+	bool afterWake = false;  // learn the boot time once a missed host comes up
+	bool missed = false;     // a whole try went unanswered
+	uint32_t windowStart = 0;  // expected boot window, ms after startedAt, windowEnd 0 without a model
+	uint32_t windowEnd = 0;
+	uint32_t elapsedMillis = 0;  // startedAt -> result
+
+	uint8_t attached = 0;  // later requests for the same host, answered with this result
+	icmpReplyStruct attachedReplies[ICMP_ATTACH_MAX];
 
-	unsigned long nextICMP = 0;
+	uint16_t sequence = 0;
+	unsigned long sentMicros = 0;
+
+	bool result = false;
+	uint32_t rttMicros = 0;
+
+	uint16_t traceId = TRACE_NONE;
 };
 
 struct mqttMessageStruct {
-	bool waiting = false;
+	char topic[TOPIC_SIZE];
+	char payload[MQTT_PAYLOAD_SIZE];
+	size_t length;  // payload may be binary
 
-	String topic;
-	String payload;
+	uint16_t traceIds[STATUS_COALESCE_MAX];  // requests answered by this message
+	uint8_t traceCount;
 
-	unsigned long nextTry = 0;
+	unsigned long queuedMicros;
+	unsigned long nextTry;
+	uint8_t retries;
+};
+
+struct mqttStatsStruct {
+	uint32_t published = 0;
+	uint32_t failed = 0;   // publish attempts that failed
+	uint32_t retries = 0;  // extra attempts needed by published messages
+
+	uint64_t totalLatencyMicros = 0;  // queued -> published
+	uint32_t maxLatencyMicros = 0;
+
+	uint8_t maxDepth = 0;
+	uint32_t dropped = 0;  // queue full, message discarded
+};
+
+enum mqttConnState : uint8_t {
+	MQTT_WAITING = 0,  // no WiFi or no time yet, TLS needs both
+	MQTT_BACKOFF = 1,  // last attempt failed, next one at nextAttempt
+	MQTT_CONNECTED = 2
+};
+
+// Connection to AWS, advanced by mqttConnectionProcess() from loop() without blocking between attempts
+struct mqttConnectionStruct {
+	mqttConnState state = MQTT_WAITING;
+	unsigned long since = 0;  // entered state
+
+	uint8_t failures = 0;  // connect attempts failed in a row
+	unsigned long nextAttempt = 0;
+	int lastReturnCode = 0;
+
+	unsigned long lostAt = 0;         // last time the connection was lost (or boot)
+	uint32_t lastReconnectMillis = 0;  // lostAt -> connected, for the last outage
+	uint32_t maxReconnectMillis = 0;
+};
+
+struct healthStatsStruct {
+	uint32_t mqttErrors = 0;  // every error passed to lwMQTTErr()
+	lwmqtt_err_t lastMqttError = lwmqtt_err_t::LWMQTT_SUCCESS;
+
+	uint32_t mqttConnects = 0;
+	uint32_t wifiDisconnects = 0;
+
+	uint32_t missedReports = 0;  // skipped while the broker was away, since the last published report
 };
 
 WiFiClientSecure net;
-MQTTClient client(256);  // 128 // 256
+MQTTClient client(MQTT_BUFFER_SIZE);  // 128 // 256
 
 WiFiUDP UDP;
-WakeOnLan WOL(UDP);
+
+IPAddress broadcastAddress(255, 255, 255, 255);
+SemaphoreHandle_t udpSemaphore = NULL;
+
+// Packets of the batch being sent, only touched while holding udpSemaphore
+uint8_t wakeBatchPackets[WAKE_BATCH_MAX][SECURE_MAGIC_PACKET_SIZE];
+uint8_t wakeBatchPacketSizes[WAKE_BATCH_MAX];
+
+StaticJsonDocument<MESSAGE_JSON_SIZE> messageDoc;  // reused by every messageReceived()
 
 bool timeSet = false;
 
-const size_t mqttMessagesQueueSize = 12;
-uint8_t mqttMessagesQueueIndex = 0;
+// Ring buffer, oldest message at mqttMessagesQueueHead
+const size_t mqttMessagesQueueSize = MQTT_QUEUE_SIZE;
+uint8_t mqttMessagesQueueHead = 0;
+uint8_t mqttMessagesQueueCount = 0;
 mqttMessageStruct mqttMessagesQueue[mqttMessagesQueueSize];
 
+mqttStatsStruct mqttStats;
+
+statusCoalesceStruct statusCoalesce[STATUS_COALESCE_SLOTS];
+SemaphoreHandle_t statusCoalesceSemaphore = NULL;
+
 SemaphoreHandle_t mqttQueueSemaphore = NULL;
 
-const size_t icmpQueueSize = 24;
+const size_t icmpQueueSize = ICMP_QUEUE_SIZE;
 icmpQueueStruct icmpQueue[icmpQueueSize];
 
+deadlineHeapStruct icmpSchedule;  // next deadline (echo due or echo timeout) per icmpQueue slot
+uint8_t icmpResultsPending = 0;
+uint8_t icmpQueueUsed = 0;  // slots not ICMP_IDLE
+uint8_t icmpQueueMaxUsed = 0;
+
 TaskHandle_t icmpTaskHandler = NULL;
+TaskHandle_t icmpReceiveTaskHandler = NULL;
 SemaphoreHandle_t icmpQueueSemaphore = NULL;
 
+#if defined(WORKER_POOL)
+QueueHandle_t jobQueue = NULL;  // jobStruct copies waiting for a worker
+
+wakeBatchStruct wakeBatchSlots[WAKE_BATCH_SLOTS];
+QueueHandle_t wakeBatchFreeQueue = NULL;  // indexes of idle wakeBatchSlots
+#endif
+
+dispatchStatsStruct dispatchStats;
+portMUX_TYPE dispatchStatsMux = portMUX_INITIALIZER_UNLOCKED;
+
+healthStatsStruct healthStats;
+portMUX_TYPE healthStatsMux = portMUX_INITIALIZER_UNLOCKED;
+
+mqttConnectionStruct mqttConnection;  // written by loop() only, under mqttConnectionMux
+portMUX_TYPE mqttConnectionMux = portMUX_INITIALIZER_UNLOCKED;
+
+// For stack high-water marks
+TaskHandle_t loopTaskHandler = NULL;
+TaskHandle_t ntpTaskHandler = NULL;
+
+#if defined(WORKER_POOL)
+TaskHandle_t workerTaskHandlers[WORKER_POOL_SIZE];
+#endif
+
+#if defined(DISCOVERY_SWEEP)
+TaskHandle_t discoveryTaskHandler = NULL;
+#endif
+
+#if defined(WAKE_SCHEDULER)
+TaskHandle_t wakeSchedulerTaskHandler = NULL;
+#endif
+
+#if defined(SCHEDULED_WAKES)
+TaskHandle_t scheduleTaskHandler = NULL;
+#endif
+
 #endif
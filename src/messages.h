@@ -0,0 +1,125 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MESSAGES_h
+#define MESSAGES_h
+
+#include <Arduino.h>
+
+#include "magicpacket.h"
+#include "settings.h"
+
+// Encoding of the request, replies are sent back in the same one
+enum messageFormat : uint8_t {
+	FORMAT_JSON = 0,
+	FORMAT_BINARY = 1  // see wireformat.h
+};
+
+// How a status check confirms the host, ARP only works on the local subnet
+enum probeMethod : uint8_t {
+	PROBE_ICMP = 0,
+	PROBE_ARP = 1,
+	PROBE_AUTO = 2,  // ARP first, ICMP fallback
+	PROBE_ANNOUNCE = 3,  // result only, the host sent a DHCP request or gratuitous ARP itself
+	PROBE_BUSY = 4       // result only, no status check was run because the ICMP queue was full
+};
+
+// Where the magic packets of a wake go
+enum wakeDelivery : uint8_t {
+	DELIVER_LOCAL = 0,     // broadcast on our own subnet
+	DELIVER_DIRECTED = 1,  // directed broadcast to address, for subnets the router forwards it to
+	DELIVER_UNICAST = 2    // to address with a static ARP entry, 0 resolves it from the discovery table
+};
+
+struct wakeTargetStruct {
+	wakeDelivery delivery;
+	uint32_t address;
+};
+
+// Job structs are POD (binary MAC, IPv4 as uint32_t, fixed-size topic) so they can be
+// copied through FreeRTOS queues without touching the heap
+struct wakeMessageStruct {
+	messageFormat format;
+
+	uint8_t mac[MAC_ADDRESS_SIZE];
+	uint16_t port;
+
+	bool retrieveStatus;
+	char topic[TOPIC_SIZE];
+	uint32_t ip;
+	probeMethod probe;
+
+	bool secureOn;
+	uint8_t secureOnPassword[SECURE_ON_SIZE];
+
+	wakeTargetStruct target;
+};
+
+struct statusMessageStruct {
+	messageFormat format;
+
+	uint8_t mac[MAC_ADDRESS_SIZE];
+	char topic[TOPIC_SIZE];
+	uint32_t ip;
+	probeMethod probe;
+};
+
+struct batchDeviceStruct {
+	uint8_t mac[MAC_ADDRESS_SIZE];
+	uint16_t port;
+
+	bool retrieveStatus;
+	uint32_t ip;
+	probeMethod probe;
+
+	bool secureOn;
+	uint8_t secureOnPassword[SECURE_ON_SIZE];
+
+	wakeTargetStruct target;
+};
+
+struct wakeBatchStruct {
+	messageFormat format;
+
+	char topic[TOPIC_SIZE];
+
+	uint8_t count;
+	batchDeviceStruct devices[WAKE_BATCH_MAX];
+};
+
+struct statusResultStruct {
+	uint8_t mac[MAC_ADDRESS_SIZE];
+	bool status;
+	probeMethod method;  // PROBE_ICMP or PROBE_ARP, whichever confirmed the host
+	uint32_t rttMicros;
+	uint32_t elapsedMillis;  // status check start -> confirmed
+
+	uint16_t traceId;
+};
+
+// Results for one response topic and format collected during STATUS_COALESCE_MS
+struct statusCoalesceStruct {
+	char topic[TOPIC_SIZE];
+	messageFormat format;
+	unsigned long openedAt;
+
+	uint8_t count = 0;
+	statusResultStruct results[STATUS_COALESCE_MAX];
+};
+
+#endif
@@ -0,0 +1,109 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pingengine.h"
+
+#include "lwip/inet_chksum.h"
+#include "lwip/prot/icmp.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/sockets.h"
+
+int pingSocket = -1;
+
+bool pingEngineOpen() {
+	if (pingSocket >= 0)
+		return true;
+
+	pingSocket = socket(AF_INET, SOCK_RAW, IP_PROTO_ICMP);
+	if (pingSocket < 0)
+		return false;
+
+	fcntl(pingSocket, F_SETFL, O_NONBLOCK);
+	return true;
+}
+
+bool pingEngineReady() {
+	return pingSocket >= 0;
+}
+
+bool pingEngineSend(uint32_t ip, uint16_t sequence) {
+	uint8_t packet[sizeof(struct icmp_echo_hdr) + PING_PAYLOAD_SIZE];
+	struct icmp_echo_hdr *echo = (struct icmp_echo_hdr *)packet;
+	struct sockaddr_in to;
+
+	ICMPH_TYPE_SET(echo, ICMP_ECHO);
+	ICMPH_CODE_SET(echo, 0);
+	echo->id = htons(PING_ENGINE_ID);
+	echo->seqno = htons(sequence);
+	echo->chksum = 0;
+
+	for (uint8_t i = 0; i < PING_PAYLOAD_SIZE; i++)
+		packet[sizeof(struct icmp_echo_hdr) + i] = 'a' + (i % 26);
+
+	echo->chksum = inet_chksum(packet, sizeof(packet));
+
+	memset(&to, 0, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_addr.s_addr = ip;
+
+	return sendto(pingSocket, packet, sizeof(packet), 0, (struct sockaddr *)&to, sizeof(to)) == sizeof(packet);
+}
+
+// Waits up to timeoutMs (or forever) for the first echo reply carrying PING_ENGINE_ID, other ICMP traffic is skipped
+bool pingEngineReceive(uint32_t timeoutMs, uint32_t *ip, uint16_t *sequence) {
+	uint8_t buffer[sizeof(struct ip_hdr) + 40 + sizeof(struct icmp_echo_hdr)];
+	struct sockaddr_in from;
+	socklen_t fromLength;
+	fd_set readSet;
+	struct timeval timeout;
+
+	if (pingSocket < 0)
+		return false;
+
+	FD_ZERO(&readSet);
+	FD_SET(pingSocket, &readSet);
+
+	timeout.tv_sec = timeoutMs / 1000;
+	timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+	if (select(pingSocket + 1, &readSet, NULL, NULL, timeoutMs == PING_ENGINE_WAIT_FOREVER ? NULL : &timeout) <= 0)
+		return false;
+
+	for (;;) {
+		fromLength = sizeof(from);
+
+		int length = recvfrom(pingSocket, buffer, sizeof(buffer), 0, (struct sockaddr *)&from, &fromLength);
+		if (length <= 0)
+			return false;
+
+		struct ip_hdr *ipHeader = (struct ip_hdr *)buffer;
+		size_t ipHeaderLength = IPH_HL(ipHeader) * 4;
+
+		if ((size_t)length < ipHeaderLength + sizeof(struct icmp_echo_hdr))
+			continue;
+
+		struct icmp_echo_hdr *echo = (struct icmp_echo_hdr *)(buffer + ipHeaderLength);
+
+		if (ICMPH_TYPE(echo) != ICMP_ER || ntohs(echo->id) != PING_ENGINE_ID)
+			continue;
+
+		*ip = from.sin_addr.s_addr;
+		*sequence = ntohs(echo->seqno);
+		return true;
+	}
+}
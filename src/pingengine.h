@@ -0,0 +1,39 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PINGENGINE_h
+#define PINGENGINE_h
+
+#include <Arduino.h>
+
+#include "settings.h"
+
+#define PING_ENGINE_ID 0x5744  // ICMP echo identifier used by every request we send
+#define PING_ENGINE_WAIT_FOREVER UINT32_MAX
+
+/**
+ * Non-blocking ICMP echo over a single raw socket. Requests are matched to replies
+ * by sequence number, so any number of hosts can be in flight at the same time.
+ * Sends come from icmpTask() and receives from icmpReceiveTask(), lwIP sockets allow that split.
+ */
+bool pingEngineOpen();
+bool pingEngineReady();
+bool pingEngineSend(uint32_t ip, uint16_t sequence);
+bool pingEngineReceive(uint32_t timeoutMs, uint32_t *ip, uint16_t *sequence);
+
+#endif
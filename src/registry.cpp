@@ -0,0 +1,135 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "registry.h"
+
+#include <Preferences.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+void registryKey(uint8_t id, char *key);
+
+Preferences registryPrefs;
+
+deviceRecordStruct registryTable[REGISTRY_SIZE];
+bool registryUsed[REGISTRY_SIZE];
+
+SemaphoreHandle_t registrySemaphore = NULL;
+
+void registryBegin() {
+	char key[8];
+
+	registrySemaphore = xSemaphoreCreateMutex();
+	registryPrefs.begin(REGISTRY_NAMESPACE, false);
+
+	uint8_t version = registryPrefs.getUChar("version", 0);
+
+	// Version 1 records end before the wake target, they are kept as local broadcasts
+	bool migrate = version == 1;
+
+	if (version != REGISTRY_VERSION && !migrate)
+		registryPrefs.clear();
+
+	for (uint8_t id = 0; id < REGISTRY_SIZE; id++) {
+		size_t length;
+
+		registryKey(id, key);
+		length = registryPrefs.getBytesLength(key);
+		memset(&registryTable[id], 0, sizeof(deviceRecordStruct));
+
+		if (migrate && length == offsetof(deviceRecordStruct, target))
+			registryUsed[id] = registryPrefs.getBytes(key, &registryTable[id], length) == length &&
+							   registryPrefs.putBytes(key, &registryTable[id], sizeof(deviceRecordStruct)) == sizeof(deviceRecordStruct);
+		else
+			registryUsed[id] = length == sizeof(deviceRecordStruct) &&
+							   registryPrefs.getBytes(key, &registryTable[id], sizeof(deviceRecordStruct)) == sizeof(deviceRecordStruct);
+	}
+
+	if (version != REGISTRY_VERSION)
+		registryPrefs.putUChar("version", REGISTRY_VERSION);
+}
+
+bool registryGet(int id, deviceRecordStruct *record) {
+	bool found = false;
+
+	if (id < 0 || id >= REGISTRY_SIZE)
+		return false;
+
+	xSemaphoreTake(registrySemaphore, portMAX_DELAY);
+	if (registryUsed[id]) {
+		*record = registryTable[id];
+		found = true;
+	}
+	xSemaphoreGive(registrySemaphore);
+
+	return found;
+}
+
+bool registrySet(int id, const deviceRecordStruct *record) {
+	char key[8];
+	bool stored;
+
+	if (id < 0 || id >= REGISTRY_SIZE)
+		return false;
+
+	registryKey(id, key);
+
+	xSemaphoreTake(registrySemaphore, portMAX_DELAY);
+	stored = registryPrefs.putBytes(key, record, sizeof(deviceRecordStruct)) == sizeof(deviceRecordStruct);
+	if (stored) {
+		registryTable[id] = *record;
+		registryUsed[id] = true;
+	}
+	xSemaphoreGive(registrySemaphore);
+
+	return stored;
+}
+
+bool registryRemove(int id) {
+	char key[8];
+
+	if (id < 0 || id >= REGISTRY_SIZE)
+		return false;
+
+	registryKey(id, key);
+
+	xSemaphoreTake(registrySemaphore, portMAX_DELAY);
+	bool removed = registryUsed[id];
+
+	registryPrefs.remove(key);
+	registryUsed[id] = false;
+	xSemaphoreGive(registrySemaphore);
+
+	return removed;
+}
+
+uint8_t registryCount() {
+	uint8_t count = 0;
+
+	for (uint8_t id = 0; id < REGISTRY_SIZE; id++) {
+		if (registryUsed[id])
+			count++;
+	}
+
+	return count;
+}
+
+void registryKey(uint8_t id, char *key) {
+	snprintf(key, 8, "d%u", id);
+}
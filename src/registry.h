@@ -0,0 +1,54 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REGISTRY_h
+#define REGISTRY_h
+
+#include <Arduino.h>
+
+#include "magicpacket.h"
+#include "messages.h"
+#include "settings.h"
+
+// Stored as-is in NVS, bump REGISTRY_VERSION when the layout changes
+struct deviceRecordStruct {
+	uint8_t mac[MAC_ADDRESS_SIZE];
+	uint16_t port;
+
+	uint32_t ip;  // 0 when status is not available
+	char topic[TOPIC_SIZE];
+
+	bool secureOn;
+	uint8_t secureOnPassword[SECURE_ON_SIZE];
+
+	wakeTargetStruct target;  // appended in version 2
+};
+
+/**
+ * Devices persisted in NVS and mirrored in a RAM table indexed by device ID,
+ * so lookups are a single array access. Safe to call from any task.
+ */
+void registryBegin();
+
+bool registryGet(int id, deviceRecordStruct *record);
+bool registrySet(int id, const deviceRecordStruct *record);
+bool registryRemove(int id);
+
+uint8_t registryCount();
+
+#endif
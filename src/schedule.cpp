@@ -0,0 +1,242 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "schedule.h"
+
+#include <Preferences.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+struct scheduleEntry {
+	cronStruct cron;
+	uint32_t dueMinute;  // minutes since the epoch, 0 while not in the wheel
+	int8_t next;         // next entry in the same wheel slot or -1
+};
+
+void scheduleKey(uint8_t id, char *key);
+void scheduleWheelInsert(uint8_t id, uint32_t fromMinute);
+void scheduleWheelUnlink(uint8_t id);
+void scheduleWheelRebuild(uint32_t minute);
+
+Preferences schedulePrefs;
+
+scheduleRecordStruct scheduleTable[SCHEDULE_SIZE];
+bool scheduleUsed[SCHEDULE_SIZE];
+
+scheduleEntry scheduleEntries[SCHEDULE_SIZE];
+int8_t scheduleWheel[SCHEDULE_WHEEL_SLOTS];  // first entry per slot or -1
+uint32_t scheduleMinute = 0;                 // next minute to process, 0 before the wall time is known
+
+SemaphoreHandle_t scheduleSemaphore = NULL;
+
+void scheduleBegin() {
+	char key[8];
+
+	scheduleSemaphore = xSemaphoreCreateMutex();
+	schedulePrefs.begin(SCHEDULE_NAMESPACE, false);
+
+	if (schedulePrefs.getUChar("version", 0) != SCHEDULE_VERSION) {
+		schedulePrefs.clear();
+		schedulePrefs.putUChar("version", SCHEDULE_VERSION);
+	}
+
+	for (uint8_t slot = 0; slot < SCHEDULE_WHEEL_SLOTS; slot++)
+		scheduleWheel[slot] = -1;
+
+	for (uint8_t id = 0; id < SCHEDULE_SIZE; id++) {
+		scheduleKey(id, key);
+		scheduleEntries[id].dueMinute = 0;
+
+		scheduleUsed[id] = schedulePrefs.getBytesLength(key) == sizeof(scheduleRecordStruct) &&
+						   schedulePrefs.getBytes(key, &scheduleTable[id], sizeof(scheduleRecordStruct)) == sizeof(scheduleRecordStruct) &&
+						   cronParse(scheduleTable[id].cron, &scheduleEntries[id].cron);
+	}
+}
+
+bool scheduleGet(int id, scheduleRecordStruct *record) {
+	bool found = false;
+
+	if (id < 0 || id >= SCHEDULE_SIZE)
+		return false;
+
+	xSemaphoreTake(scheduleSemaphore, portMAX_DELAY);
+	if (scheduleUsed[id]) {
+		*record = scheduleTable[id];
+		found = true;
+	}
+	xSemaphoreGive(scheduleSemaphore);
+
+	return found;
+}
+
+bool scheduleSet(int id, const scheduleRecordStruct *record) {
+	cronStruct cron;
+	char key[8];
+	bool stored;
+
+	if (id < 0 || id >= SCHEDULE_SIZE || !cronParse(record->cron, &cron))
+		return false;
+
+	scheduleKey(id, key);
+
+	xSemaphoreTake(scheduleSemaphore, portMAX_DELAY);
+	stored = schedulePrefs.putBytes(key, record, sizeof(scheduleRecordStruct)) == sizeof(scheduleRecordStruct);
+	if (stored) {
+		scheduleWheelUnlink(id);
+
+		scheduleTable[id] = *record;
+		scheduleUsed[id] = true;
+		scheduleEntries[id].cron = cron;
+
+		if (scheduleMinute != 0)
+			scheduleWheelInsert(id, scheduleMinute);
+	}
+	xSemaphoreGive(scheduleSemaphore);
+
+	return stored;
+}
+
+bool scheduleRemove(int id) {
+	char key[8];
+
+	if (id < 0 || id >= SCHEDULE_SIZE)
+		return false;
+
+	scheduleKey(id, key);
+
+	xSemaphoreTake(scheduleSemaphore, portMAX_DELAY);
+	bool removed = scheduleUsed[id];
+
+	schedulePrefs.remove(key);
+	scheduleWheelUnlink(id);
+	scheduleUsed[id] = false;
+	xSemaphoreGive(scheduleSemaphore);
+
+	return removed;
+}
+
+time_t scheduleNextDue(int id) {
+	time_t due = 0;
+
+	if (id < 0 || id >= SCHEDULE_SIZE)
+		return 0;
+
+	xSemaphoreTake(scheduleSemaphore, portMAX_DELAY);
+	if (scheduleUsed[id])
+		due = (time_t)scheduleEntries[id].dueMinute * 60;
+	xSemaphoreGive(scheduleSemaphore);
+
+	return due;
+}
+
+uint8_t scheduleAdvance(time_t now, uint8_t *due) {
+	uint32_t nowMinute = now / 60;
+	bool fired[SCHEDULE_SIZE] = {false};
+	uint8_t count = 0;
+
+	xSemaphoreTake(scheduleSemaphore, portMAX_DELAY);
+
+	// First wall time, the clock stepped back, or too many minutes were missed to fire them now
+	if (scheduleMinute == 0 || nowMinute + 1 < scheduleMinute || nowMinute >= scheduleMinute + SCHEDULE_CATCHUP_MIN)
+		scheduleWheelRebuild(nowMinute);
+
+	for (; scheduleMinute <= nowMinute; scheduleMinute++) {
+		int8_t *link = &scheduleWheel[scheduleMinute & (SCHEDULE_WHEEL_SLOTS - 1)];
+		uint8_t firstFired = count;
+
+		// Entries a whole wheel turn (or more) away share the slot and stay
+		while (*link != -1) {
+			scheduleEntry *entry = &scheduleEntries[*link];
+
+			if (entry->dueMinute != scheduleMinute) {
+				link = &entry->next;
+				continue;
+			}
+
+			uint8_t id = *link;
+			*link = entry->next;
+			entry->dueMinute = 0;
+
+			// Runs missed while catching up fire once
+			if (!fired[id]) {
+				fired[id] = true;
+				due[count++] = id;
+			}
+		}
+
+		for (uint8_t i = firstFired; i < count; i++)
+			scheduleWheelInsert(due[i], scheduleMinute + 1);
+	}
+
+	xSemaphoreGive(scheduleSemaphore);
+
+	return count;
+}
+
+// Caller must hold scheduleSemaphore
+void scheduleWheelInsert(uint8_t id, uint32_t fromMinute) {
+	scheduleEntry *entry = &scheduleEntries[id];
+	time_t next = cronNext(&entry->cron, (time_t)fromMinute * 60);
+
+	entry->dueMinute = next / 60;
+
+	if (entry->dueMinute == 0)
+		return;
+
+	int8_t *head = &scheduleWheel[entry->dueMinute & (SCHEDULE_WHEEL_SLOTS - 1)];
+
+	entry->next = *head;
+	*head = id;
+}
+
+// Caller must hold scheduleSemaphore
+void scheduleWheelUnlink(uint8_t id) {
+	scheduleEntry *entry = &scheduleEntries[id];
+
+	if (entry->dueMinute == 0)
+		return;
+
+	for (int8_t *link = &scheduleWheel[entry->dueMinute & (SCHEDULE_WHEEL_SLOTS - 1)]; *link != -1; link = &scheduleEntries[*link].next) {
+		if (*link == id) {
+			*link = entry->next;
+			break;
+		}
+	}
+
+	entry->dueMinute = 0;
+}
+
+// Caller must hold scheduleSemaphore
+void scheduleWheelRebuild(uint32_t minute) {
+	for (uint8_t slot = 0; slot < SCHEDULE_WHEEL_SLOTS; slot++)
+		scheduleWheel[slot] = -1;
+
+	scheduleMinute = minute;
+
+	for (uint8_t id = 0; id < SCHEDULE_SIZE; id++) {
+		scheduleEntries[id].dueMinute = 0;
+
+		if (scheduleUsed[id])
+			scheduleWheelInsert(id, minute);
+	}
+}
+
+void scheduleKey(uint8_t id, char *key) {
+	snprintf(key, 8, "s%u", id);
+}
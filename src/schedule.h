@@ -0,0 +1,52 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCHEDULE_h
+#define SCHEDULE_h
+
+#include <Arduino.h>
+
+#include "cron.h"
+#include "settings.h"
+
+// Stored as-is in NVS, bump SCHEDULE_VERSION when the layout changes
+struct scheduleRecordStruct {
+	char cron[SCHEDULE_CRON_SIZE];
+	char wake[SCHEDULE_WAKE_SIZE];  // JSON body of a wake message (id 1), parsed again each time it fires
+};
+
+/**
+ * Cron schedules persisted in NVS and run from a hashed timer wheel of SCHEDULE_WHEEL_SLOTS
+ * one-minute slots: a schedule sits in the slot of its next due minute (modulo the wheel size)
+ * and each tick only walks that slot. scheduleAdvance() is fed the wall time once a minute,
+ * it fires minutes missed by up to SCHEDULE_CATCHUP_MIN and rebuilds the wheel on larger jumps.
+ * Safe to call from any task.
+ */
+void scheduleBegin();
+
+bool scheduleGet(int id, scheduleRecordStruct *record);
+bool scheduleSet(int id, const scheduleRecordStruct *record);
+bool scheduleRemove(int id);
+
+// Next due time of a schedule, 0 when the wheel has not started (no wall time yet) or it never fires
+time_t scheduleNextDue(int id);
+
+// IDs of the schedules due up to now, each is moved to its next due minute
+uint8_t scheduleAdvance(time_t now, uint8_t *due);
+
+#endif
@@ -30,8 +30,54 @@
 
 #define REPEAT_MAGIC_PACKET 3  //At least 1
 #define REPEAT_MAGIC_PACKET_DELAY_MS 100
-
-#define RETRY_CONN_AWS_SEC 5
+#define MAGIC_PACKET_CACHE_SIZE 16 // prebuilt packets kept for repeat wakes (LRU)
+
+#define MQTT_RECONNECT_BASE_MS 2000 // first reconnect after a failed connect, doubled per failure
+#define MQTT_RECONNECT_MAX_MS 120000
+
+#define TLS_SESSION_RESUME // comment to do a full TLS handshake on every reconnect
+#define TLS_TICKET_SIZE 1024 // largest session ticket kept in RTC memory, larger ones resume by session ID
+
+#define WORKER_POOL // comment to spawn a task per message instead
+#define WORKER_POOL_SIZE 2 // long-lived worker tasks
+#define WORKER_JOB_SLOTS 16 // preallocated jobs waiting for a worker
+#define WORKER_STACK_SIZE 3072
+
+#define WAKE_BATCH_MAX 32 // devices accepted in one batch wake message
+#define WAKE_BATCH_SLOTS 2 // batch wake messages buffered at once
+
+#define REGISTRY_SIZE 64 // device IDs 0..REGISTRY_SIZE-1 stored in NVS
+#define REGISTRY_NAMESPACE "registry"
+#define REGISTRY_VERSION 2 // bump when deviceRecordStruct changes, clears stored devices (1 is migrated)
+#define REGISTRY_LIST_CHUNK 4 // devices per list reply page, fewer when they would not fit MQTT_PAYLOAD_SIZE
+
+#define SCHEDULED_WAKES // comment to disable on-device cron schedules
+#define SCHEDULE_SIZE 16 // schedule IDs 0..SCHEDULE_SIZE-1 stored in NVS, at most 127
+#define SCHEDULE_NAMESPACE "schedules"
+#define SCHEDULE_VERSION 1 // bump when scheduleRecordStruct changes, clears stored schedules
+#define SCHEDULE_CRON_SIZE 48 // cron expression, including terminator
+#define SCHEDULE_WAKE_SIZE 192 // wake message (id 1 body) run by a schedule, including terminator
+#define SCHEDULE_WHEEL_SLOTS 64 // one per minute, power of two
+#define SCHEDULE_CATCHUP_MIN 5 // missed minutes still fired after a stall, a larger clock jump skips them
+#define SCHEDULE_LIST_CHUNK 2 // schedules per list reply page, fewer when they would not fit MQTT_PAYLOAD_SIZE
+#define CRON_SEARCH_LIMIT 1000 // month/day/hour/minute steps looking for the next match
+
+#define MQTT_BUFFER_SIZE 1024 // must hold the largest batch wake message
+#define MQTT_PAYLOAD_SIZE 512 // outbound message payload, a status batch that does not fit is split
+#define MQTT_QUEUE_SIZE 12 // outbound messages waiting for publish
+#define MQTT_DRAIN_BUDGET 8 // max publishes per loop() pass
+#define MQTT_BACKOFF_BASE_MS 500 // first retry after a failed publish, doubled per retry
+#define MQTT_BACKOFF_MAX_MS 30000
+#define MQTT_SUB_QOS 1 // wake channels, 1 redelivers requests sent while reconnecting
+#define MQTT_CLEAN_SESSION false // false keeps subscriptions and pending QoS 1 messages across reconnects
+#define DEDUP_SIZE 32 // requests remembered to drop redeliveries, see dedup.h
+#define DEDUP_WINDOW_MS 600000
+#define MESSAGE_JSON_SIZE 4096
+#define TOPIC_SIZE 64 // response topic, including terminator
+
+#define TRACE_SLOTS 32 // requests traced at the same time, see tracing.h
+#define TRACE_PARSE_ALLOCATIONS // count heap allocations inside messageReceived()
+#define BENCHMARK_RUNS 1000 // iterations per benchmark in the native environment, see test/test_benchmark
 
 #define UPDATE_FREQUENT 900000 * 6
 
@@ -40,6 +86,53 @@
 
 #define PING_RETRY_NUM 12 // try ping 12 times with delay of PING_BETWEEN_DELAY_MS between ( == 2m )
 #define PING_BETWEEN_DELAY_MS 10000 // 10000MS (10 Seconds)
+#define PING_ECHO_COUNT 3 // echo requests per try before it counts as failed
+#define PING_TIMEOUT_MS 1000 // wait for each echo reply
+#define PING_PAYLOAD_SIZE 32
+#define ICMP_QUEUE_SIZE 24 // status checks in progress, at most 255
+#define ICMP_ATTACH_MAX 2 // other reply topics joining a status check already in progress
+
+#define WAKE_SUPPRESS_MS 30000 // a MAC woken this recently gets no new magic packets, 0 to disable
+#define WAKE_GUARD_SIZE 32 // MACs remembered for WAKE_SUPPRESS_MS, power of two
+
+#define WAKE_SCHEDULER // comment to send every wake as soon as it arrives
+#define WAKE_RATE_PER_MIN 60 // sustained wakes once the burst is spent
+#define WAKE_BURST 8 // wakes sent at once before pacing starts, at most 255
+#define WAKE_SCHEDULER_QUEUE_SIZE 48 // wakes waiting for a token, at most 255
+
+#define BOOT_MODEL // comment to always retry wakes every PING_BETWEEN_DELAY_MS
+#define BOOT_MODEL_SIZE 32 // MACs with a learned wake -> online time
+#define BOOT_MODEL_NAMESPACE "bootmodel"
+#define BOOT_MODEL_VERSION 1
+#define BOOT_MODEL_WEIGHT 4 // a new sample moves the averages by 1/4 of its error
+#define BOOT_MODEL_DENSE_MS 2000 // between tries inside the expected boot window
+#define BOOT_MODEL_MIN_WINDOW_MS 5000 // half width of the boot window at least
+#define BOOT_MODEL_GRACE_MS 30000 // keep trying after the window, then give up
+
+#define PROBE_DEFAULT PROBE_AUTO // PROBE_ICMP, PROBE_ARP or PROBE_AUTO (ARP first, ICMP fallback) when a request sets none
+#define ARP_PROBE_COUNT 2 // ARP requests per try, before ICMP in PROBE_AUTO
+#define ARP_TIMEOUT_MS 250 // wait for each ARP reply
+#define ARP_WATCH_SIZE ICMP_QUEUE_SIZE
+#define ARP_FRAME_QUEUE_SIZE 8
+#define ARP_STATIC_SLOTS WAKE_BATCH_MAX // static entries being added for unicast wakes
+
+#define ANNOUNCE_LISTEN // comment to confirm wakes by probing only, not by the host's own DHCP request/gratuitous ARP
+#define ANNOUNCE_WATCH_SIZE ICMP_QUEUE_SIZE
+#define ANNOUNCE_QUEUE_SIZE 8
+#define ANNOUNCE_DHCP_SIZE 576 // DHCP message bytes parsed, the minimum every client must accept
+
+#define DISCOVERY_SWEEP // comment to disable the background ARP sweep, hosts are still learned passively
+#define DISCOVERY_TABLE_SIZE 64 // learned MAC -> IP bindings
+#define DISCOVERY_PPS 10 // sweep budget, ARP requests per second
+#define DISCOVERY_DEFER_MS 5000 // pause the sweep after each wake
+#define DISCOVERY_INTERVAL_MS 600000 // between sweeps of the whole subnet (10 minutes)
+
+#define STATUS_COALESCE_MS 50 // merge status results for the same topic within this window, 0 to disable
+#define STATUS_COALESCE_MAX 8 // results per merged message
+#define STATUS_COALESCE_SLOTS 4 // topics being merged at the same time
+
+#define HEALTH_METRICS // comment to disable periodic health reports on MQTT_PUB_HEALTH
+#define HEALTH_INTERVAL_MS 300000 // 5 minutes
 
 #define FAILED_DELAY_MS 5000
 #define LONG_DELAY_MS 3600000 // 3600000 = 1H
@@ -55,15 +148,24 @@
 #define NTP_SERV2 "1.asia.pool.ntp.org"
 #define NTP_SERV3 "0.europe.pool.ntp.org"
 
+#define LOG_LEVEL LOG_INFO // LOG_ERROR, LOG_WARN, LOG_INFO or LOG_DEBUG, see logger.h
+#define LOG_RING_SIZE 64 // records waiting for logTask(), power of two
+#define LOG_MAX_ARGS 6
+#define LOG_TEXT_SIZE 48 // copied string per record, see logText()
+#define LOG_LINE_SIZE 160
+#define LOG_DRAIN_MS 20
+
 #if defined(PRINT_TO_SERIAL)
 #define Sprintln(a) (Serial.println(a))
 #define Sprint(a) (Serial.print(a))
 #define Sprintf(a, b) (Serial.printf(a, b))
+#define Swrite(a, b) (Serial.write(a, b))
 #define Sjson(a, b) (serializeJson(a, b))
 #else
 #define Sprintln(a)
 #define Sprint(a)
 #define Sprintf(a, b)
+#define Swrite(a, b)
 #define Sjson(a, b)
 #endif
 
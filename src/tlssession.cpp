@@ -0,0 +1,180 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tlssession.h"
+
+#include <esp_attr.h>
+
+#include "mbedtls/ssl.h"
+
+#define TLS_SESSION_MAGIC (0x544C5300 ^ (uint32_t)BUILD_TIMESTAMP)  // mbedtls_ssl_session layout is only stable within a build
+
+// Copy of the session with every pointer cleared, the ticket is kept next to it
+struct tlsSessionStore {
+	uint32_t magic;
+	mbedtls_ssl_session session;
+	uint8_t ticket[TLS_TICKET_SIZE];
+};
+
+RTC_NOINIT_ATTR tlsSessionStore tlsStore;
+
+const char *tlsHost = NULL;
+mbedtls_ssl_context *tlsHandshakeContext = NULL;  // handshake in progress, WiFiClientSecure calls again on WANT_READ/WANT_WRITE
+unsigned long tlsHandshakeStart = 0;
+bool tlsOffered = false;
+
+tlsSessionStats tlsStats;
+portMUX_TYPE tlsStatsMux = portMUX_INITIALIZER_UNLOCKED;
+
+extern "C" int __real_mbedtls_ssl_handshake(mbedtls_ssl_context *ssl);
+extern "C" int __wrap_mbedtls_ssl_handshake(mbedtls_ssl_context *ssl);
+
+bool tlsSessionOffer(mbedtls_ssl_context *ssl);
+void tlsSessionStrip(mbedtls_ssl_session *session);
+void tlsSessionSave(mbedtls_ssl_context *ssl);
+void tlsSessionDone(mbedtls_ssl_context *ssl, int result);
+
+void tlsSessionBegin(const char *host) {
+	tlsHost = host;
+
+	// Power-on leaves RTC memory random, a new build may change the struct
+	if (tlsStore.magic != TLS_SESSION_MAGIC)
+		tlsSessionClear();
+}
+
+void tlsSessionClear() {
+	memset(&tlsStore, 0, sizeof(tlsStore));
+}
+
+tlsSessionStats tlsSessionGetStats() {
+	tlsSessionStats stats;
+
+	portENTER_CRITICAL(&tlsStatsMux);
+	stats = tlsStats;
+	portEXIT_CRITICAL(&tlsStatsMux);
+
+	return stats;
+}
+
+// Only for handshakes with tlsHost, before the ClientHello is written
+bool tlsSessionOffer(mbedtls_ssl_context *ssl) {
+	if (tlsStore.magic != TLS_SESSION_MAGIC)
+		return false;
+
+	mbedtls_ssl_session session = tlsStore.session;
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+	session.ticket = session.ticket_len > 0 ? tlsStore.ticket : NULL;
+#endif
+
+	// Deep copy, nothing to free here
+	return mbedtls_ssl_set_session(ssl, &session) == 0;
+}
+
+// Clears every pointer of a shallow copy, they point into heap that is gone after a restart
+void tlsSessionStrip(mbedtls_ssl_session *session) {
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+	// Not needed to resume, the chain was verified on the full handshake.
+	// Without MBEDTLS_SSL_KEEP_PEER_CERTIFICATE (mbedtls 2.17+) only a digest of it is kept
+#if defined(MBEDTLS_SSL_PEER_CERT_DIGEST_DFL_LEN)
+	session->peer_cert_digest = NULL;
+	session->peer_cert_digest_len = 0;
+	session->peer_cert_digest_type = MBEDTLS_MD_NONE;
+#else
+	session->peer_cert = NULL;
+#endif
+#endif
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+	session->ticket = NULL;  // tlsStore.ticket holds the bytes
+#endif
+}
+
+void tlsSessionSave(mbedtls_ssl_context *ssl) {
+	mbedtls_ssl_session session;
+
+	mbedtls_ssl_session_init(&session);
+
+	if (mbedtls_ssl_get_session(ssl, &session) == 0) {
+		tlsStore.session = session;
+		tlsSessionStrip(&tlsStore.session);
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+		// Too large for RTC memory, resume by session ID only
+		if (session.ticket == NULL || session.ticket_len > TLS_TICKET_SIZE)
+			tlsStore.session.ticket_len = 0;
+		else
+			memcpy(tlsStore.ticket, session.ticket, session.ticket_len);
+#endif
+
+		tlsStore.magic = TLS_SESSION_MAGIC;
+	}
+
+	mbedtls_ssl_session_free(&session);
+}
+
+void tlsSessionDone(mbedtls_ssl_context *ssl, int result) {
+	uint32_t elapsed = millis() - tlsHandshakeStart;
+	bool resumed = false;
+
+	if (result == 0) {
+		// A full handshake derives a new master secret
+		resumed = tlsOffered && tlsStore.magic == TLS_SESSION_MAGIC && memcmp(ssl->session->master, tlsStore.session.master, sizeof(tlsStore.session.master)) == 0;
+
+		tlsSessionSave(ssl);
+	} else if (tlsOffered)
+		tlsSessionClear();  // the server may have choked on it, next try goes without
+
+	portENTER_CRITICAL(&tlsStatsMux);
+	if (result == 0) {
+		tlsStats.handshakes++;
+		tlsStats.lastMillis = elapsed;
+
+		if (resumed) {
+			tlsStats.resumed++;
+			tlsStats.resumedMillis += elapsed;
+		} else
+			tlsStats.fullMillis += elapsed;
+	} else
+		tlsStats.failed++;
+	portEXIT_CRITICAL(&tlsStatsMux);
+
+	tlsHandshakeContext = NULL;
+}
+
+// Runs on the task calling WiFiClientSecure::connect(), once per handshake step batch
+int __wrap_mbedtls_ssl_handshake(mbedtls_ssl_context *ssl) {
+	bool tracked = tlsHost != NULL && ssl->hostname != NULL && strcmp(ssl->hostname, tlsHost) == 0;
+
+	if (tracked && ssl->state == MBEDTLS_SSL_HELLO_REQUEST) {
+		// WiFiClientSecure gave up on the previous one (handshake timeout)
+		if (tlsHandshakeContext != NULL)
+			tlsSessionDone(tlsHandshakeContext, -1);
+
+		tlsHandshakeContext = ssl;
+		tlsHandshakeStart = millis();
+		tlsOffered = tlsSessionOffer(ssl);
+	}
+
+	int result = __real_mbedtls_ssl_handshake(ssl);
+
+	if (tracked && tlsHandshakeContext == ssl && result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE)
+		tlsSessionDone(ssl, result);
+
+	return result;
+}
@@ -0,0 +1,48 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TLSSESSION_h
+#define TLSSESSION_h
+
+#include <Arduino.h>
+
+#include "settings.h"
+
+struct tlsSessionStats {
+	uint32_t handshakes = 0;  // completed
+	uint32_t resumed = 0;     // of which reused the cached session
+	uint32_t failed = 0;
+
+	uint32_t lastMillis = 0;  // first ClientHello -> handshake done
+	uint32_t fullMillis = 0;  // totals, divide by handshakes - resumed / resumed
+	uint32_t resumedMillis = 0;
+};
+
+/**
+ * TLS session resumption for the connection to host, through a linker wrap of
+ * mbedtls_ssl_handshake() (-Wl,--wrap=mbedtls_ssl_handshake) since WiFiClientSecure
+ * runs setup and handshake in one call with no way to hand it a session.
+ * The last session (ID, master secret and ticket) is kept in RTC memory, so it
+ * survives soft restarts of the same build, and offered on the next handshake.
+ * A resumed handshake is told apart by the master secret, which only a resumption reuses.
+ */
+void tlsSessionBegin(const char *host);
+void tlsSessionClear();
+tlsSessionStats tlsSessionGetStats();
+
+#endif
@@ -0,0 +1,123 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tracing.h"
+
+#include "freertos/FreeRTOS.h"
+
+#include "logger.h"
+
+// Microseconds
+const uint32_t traceBucketBounds[TRACE_BUCKETS - 1] = {
+	100, 500, 1000, 5000, 10000, 50000, 100000, 500000,
+	1000000, 5000000, 10000000, 30000000, 60000000, 120000000, 300000000};
+
+struct traceRecord {
+	uint16_t id;
+	unsigned long receivedMicros;
+	uint8_t stagesSeen;  // bit per traceStage
+};
+
+traceRecord traceRing[TRACE_SLOTS];
+traceHistogramStruct traceHistograms[TRACE_STAGES];
+uint16_t traceNextId = 1;
+
+portMUX_TYPE traceMux = portMUX_INITIALIZER_UNLOCKED;
+
+uint16_t traceBegin(unsigned long receivedMicros) {
+	portENTER_CRITICAL(&traceMux);
+
+	uint16_t id = traceNextId++;
+	if (traceNextId == TRACE_NONE)
+		traceNextId = 1;
+
+	traceRecord *record = &traceRing[id % TRACE_SLOTS];
+	record->id = id;
+	record->receivedMicros = receivedMicros;
+	record->stagesSeen = 0;
+
+	portEXIT_CRITICAL(&traceMux);
+
+	return id;
+}
+
+void traceMark(uint16_t id, traceStage stage) {
+	unsigned long now = micros();
+	uint32_t latency = 0;
+	bool counted = false;
+
+	if (id == TRACE_NONE)
+		return;
+
+	portENTER_CRITICAL(&traceMux);
+
+	traceRecord *record = &traceRing[id % TRACE_SLOTS];
+
+	if (record->id == id && !(record->stagesSeen & (1 << stage))) {
+		traceHistogramStruct *histogram = &traceHistograms[stage];
+		uint8_t bucket = 0;
+
+		latency = now - record->receivedMicros;
+		record->stagesSeen |= 1 << stage;
+
+		while (bucket < TRACE_BUCKETS - 1 && latency >= traceBucketBounds[bucket])
+			bucket++;
+
+		histogram->buckets[bucket]++;
+		histogram->count++;
+
+		if (latency > histogram->maxMicros)
+			histogram->maxMicros = latency;
+
+		counted = true;
+	}
+
+	portEXIT_CRITICAL(&traceMux);
+
+	if (counted)
+		Ldebug("trace #%u %s +%uus", id, traceStageName(stage), latency);
+}
+
+void traceHistogram(traceStage stage, traceHistogramStruct *histogram) {
+	portENTER_CRITICAL(&traceMux);
+	*histogram = traceHistograms[stage];
+	portEXIT_CRITICAL(&traceMux);
+}
+
+void traceReset() {
+	portENTER_CRITICAL(&traceMux);
+	memset(traceHistograms, 0, sizeof(traceHistograms));
+	portEXIT_CRITICAL(&traceMux);
+}
+
+const char *traceStageName(traceStage stage) {
+	switch (stage) {
+		case TRACE_PARSED:
+			return "parsed";
+		case TRACE_DISPATCHED:
+			return "dispatched";
+		case TRACE_SENT:
+			return "sent";
+		case TRACE_CONFIRMED:
+			return "confirmed";
+		case TRACE_PUBLISHED:
+			return "published";
+		default:
+			return "unknown";
+	}
+}
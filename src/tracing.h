@@ -0,0 +1,59 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACING_h
+#define TRACING_h
+
+#include <Arduino.h>
+
+#include "settings.h"
+
+/**
+ * Per-request stage timestamps keyed by a correlation id handed out by dispatchJob() for valid wake, status and batch jobs.
+ * Each stage is measured from the moment the message arrived and lands in a fixed-bucket
+ * histogram, only the first occurrence of a stage counts (e.g. the first confirmed device of a batch).
+ * Traces live in a ring of TRACE_SLOTS, a mark for an overwritten trace is ignored.
+ */
+enum traceStage : uint8_t {
+	TRACE_PARSED = 0,  // message decoded, job handed to dispatch
+	TRACE_DISPATCHED,  // job picked up by a worker
+	TRACE_SENT,        // magic packet(s) sent
+	TRACE_CONFIRMED,   // first successful status probe
+	TRACE_PUBLISHED,   // reply published to the broker
+	TRACE_STAGES
+};
+
+#define TRACE_NONE 0
+#define TRACE_BUCKETS 16
+
+struct traceHistogramStruct {
+	uint32_t count;
+	uint32_t maxMicros;
+	uint32_t buckets[TRACE_BUCKETS];  // bucket i counts latencies below traceBucketBounds[i], the last one the rest
+};
+
+extern const uint32_t traceBucketBounds[TRACE_BUCKETS - 1];
+
+uint16_t traceBegin(unsigned long receivedMicros);
+void traceMark(uint16_t id, traceStage stage);
+
+void traceHistogram(traceStage stage, traceHistogramStruct *histogram);
+void traceReset();
+const char *traceStageName(traceStage stage);
+
+#endif
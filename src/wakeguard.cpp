@@ -0,0 +1,97 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "wakeguard.h"
+
+#include "freertos/FreeRTOS.h"
+
+#include "deadlineheap.h"
+
+struct wakeGuardEntry {
+	bool used;  // never cleared, an expired entry is reused in place
+	uint8_t mac[MAC_ADDRESS_SIZE];
+	unsigned long wokenAt;
+};
+
+wakeGuardEntry wakeGuardTable[WAKE_GUARD_SIZE];
+uint32_t wakeGuardSuppressedCount = 0;
+portMUX_TYPE wakeGuardMux = portMUX_INITIALIZER_UNLOCKED;
+
+uint8_t wakeGuardHash(const uint8_t *mac);
+
+// True when the caller should send the wake, false when one went out within WAKE_SUPPRESS_MS
+bool wakeGuardClaim(const uint8_t *mac) {
+	wakeGuardEntry *vacant = NULL;
+	wakeGuardEntry *match = NULL;
+	unsigned long now = millis();
+	bool claimed = true;
+
+	portENTER_CRITICAL(&wakeGuardMux);
+
+	// Linear probing, a MAC is only ever stored once so the first unused slot ends the search
+	for (uint8_t i = 0, slot = wakeGuardHash(mac); i < WAKE_GUARD_SIZE; i++, slot = (slot + 1) & (WAKE_GUARD_SIZE - 1)) {
+		wakeGuardEntry *entry = &wakeGuardTable[slot];
+		bool expired = !entry->used || deadlineReached(entry->wokenAt + WAKE_SUPPRESS_MS, now);
+
+		if (entry->used && memcmp(entry->mac, mac, MAC_ADDRESS_SIZE) == 0) {
+			match = entry;
+			break;
+		}
+
+		if (expired && vacant == NULL)
+			vacant = entry;
+
+		if (!entry->used)
+			break;
+	}
+
+	if (match != NULL && !deadlineReached(match->wokenAt + WAKE_SUPPRESS_MS, now)) {
+		wakeGuardSuppressedCount++;
+		claimed = false;
+	} else {
+		if (match == NULL)
+			match = vacant;
+
+		if (match != NULL) {
+			match->used = true;
+			memcpy(match->mac, mac, MAC_ADDRESS_SIZE);
+			match->wokenAt = now;
+		}
+	}
+
+	portEXIT_CRITICAL(&wakeGuardMux);
+
+	return claimed;
+}
+
+uint32_t wakeGuardSuppressed() {
+	uint32_t suppressed;
+
+	portENTER_CRITICAL(&wakeGuardMux);
+	suppressed = wakeGuardSuppressedCount;
+	portEXIT_CRITICAL(&wakeGuardMux);
+
+	return suppressed;
+}
+
+// The vendor part of a MAC is shared by many hosts, hash the device part
+uint8_t wakeGuardHash(const uint8_t *mac) {
+	uint32_t key = ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | mac[5];
+
+	return ((key * 2654435761UL) >> 24) & (WAKE_GUARD_SIZE - 1);
+}
@@ -0,0 +1,36 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WAKEGUARD_h
+#define WAKEGUARD_h
+
+#include <Arduino.h>
+
+#include "magicpacket.h"
+#include "settings.h"
+
+/**
+ * Per-MAC wake suppression: a MAC woken less than WAKE_SUPPRESS_MS ago is not sent
+ * another magic packet burst, the request joins the wake (and status check) in flight.
+ * Fixed-size open-addressing hash table, WAKE_GUARD_SIZE must be a power of two.
+ * When every slot holds a live entry the wake goes out (fail open).
+ */
+bool wakeGuardClaim(const uint8_t *mac);
+uint32_t wakeGuardSuppressed();
+
+#endif
@@ -0,0 +1,155 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "wakescheduler.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#define WAKE_TOKEN_MS (60000UL / WAKE_RATE_PER_MIN)
+
+struct wakeBucketStruct {
+	uint8_t tokens;
+	unsigned long refilledAt;  // time the last whole token was added
+};
+
+wakeBucketStruct wakeBucket;
+wakeSchedulerStatsStruct wakeSchedulerStats;
+portMUX_TYPE wakeSchedulerMux = portMUX_INITIALIZER_UNLOCKED;
+
+QueueHandle_t wakeSchedulerQueue = NULL;
+
+void wakeBucketRefill(unsigned long now);
+uint32_t wakeBucketWait(uint8_t tokens, unsigned long now);
+
+void wakeSchedulerBegin() {
+	wakeSchedulerQueue = xQueueCreate(WAKE_SCHEDULER_QUEUE_SIZE, sizeof(wakeQueuedStruct));
+
+	wakeBucket.tokens = WAKE_BURST;
+	wakeBucket.refilledAt = millis();
+}
+
+uint8_t wakeSchedulerTake(uint8_t count) {
+	uint8_t granted = 0;
+
+	// Waiting wakes keep their turn, new ones line up behind them
+	if (uxQueueMessagesWaiting(wakeSchedulerQueue) > 0)
+		return 0;
+
+	portENTER_CRITICAL(&wakeSchedulerMux);
+	wakeBucketRefill(millis());
+
+	granted = min(count, wakeBucket.tokens);
+	wakeBucket.tokens -= granted;
+	portEXIT_CRITICAL(&wakeSchedulerMux);
+
+	return granted;
+}
+
+bool wakeSchedulerEnqueue(const wakeMessageStruct *device, uint16_t traceId, uint8_t *position, uint32_t *etaMillis) {
+	wakeQueuedStruct job;
+
+	job.device = *device;
+	job.traceId = traceId;
+
+	if (xQueueSend(wakeSchedulerQueue, &job, 0) != pdTRUE) {
+		portENTER_CRITICAL(&wakeSchedulerMux);
+		wakeSchedulerStats.dropped++;
+		portEXIT_CRITICAL(&wakeSchedulerMux);
+
+		return false;
+	}
+
+	// Estimate only, the dispatch task may have taken the head meanwhile
+	uint8_t waiting = uxQueueMessagesWaiting(wakeSchedulerQueue);
+
+	portENTER_CRITICAL(&wakeSchedulerMux);
+	wakeBucketRefill(millis());
+
+	*position = waiting;
+	*etaMillis = wakeBucketWait(waiting, millis());
+
+	wakeSchedulerStats.queued++;
+	if (waiting > wakeSchedulerStats.maxWaiting)
+		wakeSchedulerStats.maxWaiting = waiting;
+	portEXIT_CRITICAL(&wakeSchedulerMux);
+
+	return true;
+}
+
+void wakeSchedulerNext(wakeQueuedStruct *job) {
+	for (;;) {
+		uint32_t wait;
+
+		xQueuePeek(wakeSchedulerQueue, job, portMAX_DELAY);
+
+		portENTER_CRITICAL(&wakeSchedulerMux);
+		wakeBucketRefill(millis());
+
+		if (wakeBucket.tokens > 0) {
+			wakeBucket.tokens--;
+			wait = 0;
+		} else {
+			wait = wakeBucketWait(1, millis());
+		}
+		portEXIT_CRITICAL(&wakeSchedulerMux);
+
+		// Only this task receives, the peeked job is still the head
+		if (wait == 0) {
+			xQueueReceive(wakeSchedulerQueue, job, 0);
+			return;
+		}
+
+		vTaskDelay(pdMS_TO_TICKS(wait) > 0 ? pdMS_TO_TICKS(wait) : 1);
+	}
+}
+
+wakeSchedulerStatsStruct wakeSchedulerGetStats() {
+	wakeSchedulerStatsStruct stats;
+
+	portENTER_CRITICAL(&wakeSchedulerMux);
+	stats = wakeSchedulerStats;
+	portEXIT_CRITICAL(&wakeSchedulerMux);
+
+	stats.waiting = uxQueueMessagesWaiting(wakeSchedulerQueue);
+
+	return stats;
+}
+
+// Whole tokens only, the remainder of the interval carries over in refilledAt. Caller must hold wakeSchedulerMux
+void wakeBucketRefill(unsigned long now) {
+	unsigned long elapsed = now - wakeBucket.refilledAt;
+	unsigned long added = elapsed / WAKE_TOKEN_MS;
+
+	if (wakeBucket.tokens + added >= WAKE_BURST) {
+		wakeBucket.tokens = WAKE_BURST;
+		wakeBucket.refilledAt = now;
+	} else if (added > 0) {
+		wakeBucket.tokens += added;
+		wakeBucket.refilledAt += added * WAKE_TOKEN_MS;
+	}
+}
+
+// Milliseconds until the bucket holds tokens, after a refill. Caller must hold wakeSchedulerMux
+uint32_t wakeBucketWait(uint8_t tokens, unsigned long now) {
+	if (wakeBucket.tokens >= tokens)
+		return 0;
+
+	return (tokens - wakeBucket.tokens) * WAKE_TOKEN_MS - (now - wakeBucket.refilledAt);
+}
@@ -0,0 +1,58 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WAKESCHEDULER_h
+#define WAKESCHEDULER_h
+
+#include <Arduino.h>
+
+#include "messages.h"
+#include "settings.h"
+
+/**
+ * Token bucket pacing for magic packet bursts: WAKE_BURST wakes go out at once, after that
+ * one every 60000 / WAKE_RATE_PER_MIN ms. Wakes over the budget wait in a FIFO of
+ * WAKE_SCHEDULER_QUEUE_SIZE entries and are handed to the dispatch task in arrival order,
+ * so their status checks start (and their boot windows open) staggered the same way.
+ */
+struct wakeQueuedStruct {
+	wakeMessageStruct device;
+	uint16_t traceId;
+};
+
+struct wakeSchedulerStatsStruct {
+	uint8_t waiting;
+	uint8_t maxWaiting;
+	uint32_t queued;   // wakes that did not go out on arrival
+	uint32_t dropped;  // queue full
+};
+
+void wakeSchedulerBegin();
+
+// Tokens granted for an immediate burst of up to count wakes, 0 while older wakes still wait
+uint8_t wakeSchedulerTake(uint8_t count);
+
+// Appends to the queue, position 1 is next in line and etaMillis its expected dispatch
+bool wakeSchedulerEnqueue(const wakeMessageStruct *device, uint16_t traceId, uint8_t *position, uint32_t *etaMillis);
+
+// Blocks until the oldest queued wake has a token, then removes it
+void wakeSchedulerNext(wakeQueuedStruct *job);
+
+wakeSchedulerStatsStruct wakeSchedulerGetStats();
+
+#endif
@@ -0,0 +1,265 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "wireformat.h"
+
+#include "registry.h"
+
+struct wireReader {
+	const uint8_t *data;
+	size_t length;
+	size_t offset;
+};
+
+bool wireRead(wireReader *reader, void *out, size_t size);
+bool wireReadTopic(wireReader *reader, char *topic);
+bool wireReadDevice(wireReader *reader, batchDeviceStruct *device, char *recordTopic = NULL);
+uint8_t *wireWrite32(uint8_t *out, uint32_t value);
+
+// data[0] is the message id, already checked by the caller
+bool wireDecodeWake(const uint8_t *data, size_t length, wakeMessageStruct *device) {
+	wireReader reader = {data, length, 1};
+	batchDeviceStruct entry;
+	char recordTopic[TOPIC_SIZE] = "";
+
+	memset(device, 0, sizeof(wakeMessageStruct));
+	device->format = FORMAT_BINARY;
+
+	if (!wireReadDevice(&reader, &entry, recordTopic) || !wireReadTopic(&reader, device->topic))
+		return false;
+
+	if (device->topic[0] == '\0')
+		strcpy(device->topic, recordTopic);
+
+	memcpy(device->mac, entry.mac, MAC_ADDRESS_SIZE);
+	device->port = entry.port;
+
+	device->ip = entry.ip;
+	device->probe = entry.probe;
+	device->retrieveStatus = entry.retrieveStatus && device->topic[0] != '\0';
+
+	device->secureOn = entry.secureOn;
+	memcpy(device->secureOnPassword, entry.secureOnPassword, SECURE_ON_SIZE);
+
+	device->target = entry.target;
+
+	return reader.offset == length;
+}
+
+bool wireDecodeStatus(const uint8_t *data, size_t length, statusMessageStruct *status) {
+	wireReader reader = {data, length, 1};
+	batchDeviceStruct entry;
+	char recordTopic[TOPIC_SIZE] = "";
+
+	memset(status, 0, sizeof(statusMessageStruct));
+	status->format = FORMAT_BINARY;
+
+	if (!wireReadDevice(&reader, &entry, recordTopic) || !wireReadTopic(&reader, status->topic))
+		return false;
+
+	if (status->topic[0] == '\0')
+		strcpy(status->topic, recordTopic);
+
+	memcpy(status->mac, entry.mac, MAC_ADDRESS_SIZE);
+	status->ip = entry.ip;
+	status->probe = entry.probe;
+
+	return status->topic[0] != '\0' && reader.offset == length;
+}
+
+bool wireDecodeBatch(const uint8_t *data, size_t length, wakeBatchStruct *batch) {
+	wireReader reader = {data, length, 1};
+	uint8_t count;
+
+	memset(batch, 0, sizeof(wakeBatchStruct));
+	batch->format = FORMAT_BINARY;
+
+	if (!wireRead(&reader, &count, 1) || count == 0 || count > WAKE_BATCH_MAX)
+		return false;
+
+	if (!wireReadTopic(&reader, batch->topic))
+		return false;
+
+	for (batch->count = 0; batch->count < count; batch->count++) {
+		batchDeviceStruct *device = &batch->devices[batch->count];
+
+		if (!wireReadDevice(&reader, device))
+			return false;
+
+		device->retrieveStatus = device->retrieveStatus && batch->topic[0] != '\0';
+	}
+
+	return reader.offset == length;
+}
+
+size_t wireEncodeStatus(const statusResultStruct *results, uint8_t count, uint8_t *out, size_t size) {
+	size_t length = 2 + count * (MAC_ADDRESS_SIZE + 1 + 1 + 4 + 4);
+
+	if (length > size)
+		return 0;
+
+	out[0] = WIRE_STATUS_REPLY;
+	out[1] = count;
+
+	uint8_t *cursor = out + 2;
+	for (uint8_t i = 0; i < count; i++) {
+		memcpy(cursor, results[i].mac, MAC_ADDRESS_SIZE);
+		cursor += MAC_ADDRESS_SIZE;
+
+		*cursor++ = results[i].status;
+		*cursor++ = results[i].method;
+
+		cursor = wireWrite32(cursor, results[i].rttMicros);
+		cursor = wireWrite32(cursor, results[i].elapsedMillis);
+	}
+
+	return length;
+}
+
+size_t wireEncodeBatchAck(uint8_t devices, uint8_t sent, uint8_t statusQueued, uint8_t queued, uint32_t etaMillis, uint8_t *out, size_t size) {
+	if (size < 9)
+		return 0;
+
+	out[0] = WIRE_BATCH_ACK;
+	out[1] = devices;
+	out[2] = sent;
+	out[3] = statusQueued;
+	out[4] = queued;
+	wireWrite32(out + 5, etaMillis);
+
+	return 9;
+}
+
+size_t wireEncodeWakeQueued(const uint8_t *mac, uint8_t position, uint32_t etaMillis, uint8_t *out, size_t size) {
+	if (size < 2 + MAC_ADDRESS_SIZE + 4)
+		return 0;
+
+	out[0] = WIRE_WAKE_QUEUED;
+	memcpy(out + 1, mac, MAC_ADDRESS_SIZE);
+	out[1 + MAC_ADDRESS_SIZE] = position;
+	wireWrite32(out + 2 + MAC_ADDRESS_SIZE, etaMillis);
+
+	return 2 + MAC_ADDRESS_SIZE + 4;
+}
+
+bool wireRead(wireReader *reader, void *out, size_t size) {
+	if (reader->offset + size > reader->length)
+		return false;
+
+	memcpy(out, reader->data + reader->offset, size);
+	reader->offset += size;
+
+	return true;
+}
+
+bool wireReadTopic(wireReader *reader, char *topic) {
+	uint8_t length;
+
+	if (!wireRead(reader, &length, 1) || length >= TOPIC_SIZE)
+		return false;
+
+	if (!wireRead(reader, topic, length))
+		return false;
+
+	topic[length] = '\0';
+	return true;
+}
+
+// recordTopic receives the registry topic when the device is given by id, used when the request has none
+bool wireReadDevice(wireReader *reader, batchDeviceStruct *device, char *recordTopic) {
+	uint8_t flags, id, port[2];
+
+	memset(device, 0, sizeof(batchDeviceStruct));
+
+	if (!wireRead(reader, &flags, 1))
+		return false;
+
+	if (flags & WIRE_DEVICE_ID) {
+		deviceRecordStruct record;
+
+		if (!wireRead(reader, &id, 1) || !registryGet(id, &record))
+			return false;
+
+		memcpy(device->mac, record.mac, MAC_ADDRESS_SIZE);
+		device->port = record.port;
+		device->ip = record.ip;
+
+		device->secureOn = record.secureOn;
+		memcpy(device->secureOnPassword, record.secureOnPassword, SECURE_ON_SIZE);
+
+		device->target = record.target;
+
+		if (recordTopic != NULL)
+			strcpy(recordTopic, record.topic);
+	} else {
+		if (!wireRead(reader, device->mac, MAC_ADDRESS_SIZE) || !wireRead(reader, port, 2))
+			return false;
+
+		device->port = (port[0] << 8) | port[1];
+	}
+
+	if ((flags & WIRE_IP) && !wireRead(reader, &device->ip, 4))
+		return false;
+
+	if (flags & WIRE_SECURE_ON) {
+		if (!wireRead(reader, device->secureOnPassword, SECURE_ON_SIZE))
+			return false;
+
+		device->secureOn = true;
+	}
+
+	if ((flags & WIRE_DIRECTED) && (flags & WIRE_UNICAST))
+		return false;
+
+	if (flags & WIRE_DIRECTED) {
+		if (!wireRead(reader, &device->target.address, 4))
+			return false;
+
+		device->target.delivery = DELIVER_DIRECTED;
+	} else if (flags & WIRE_UNICAST) {
+		device->target.delivery = DELIVER_UNICAST;
+		device->target.address = device->ip;
+	}
+
+	switch (flags & WIRE_PROBE_MASK) {
+		case WIRE_PROBE_ICMP:
+			device->probe = PROBE_ICMP;
+			break;
+		case WIRE_PROBE_ARP:
+			device->probe = PROBE_ARP;
+			break;
+		case WIRE_PROBE_AUTO:
+			device->probe = PROBE_AUTO;
+			break;
+		default:
+			device->probe = PROBE_DEFAULT;
+			break;
+	}
+
+	device->retrieveStatus = flags & WIRE_STATUS;
+	return true;
+}
+
+uint8_t *wireWrite32(uint8_t *out, uint32_t value) {
+	*out++ = value >> 24;
+	*out++ = value >> 16;
+	*out++ = value >> 8;
+	*out++ = value;
+
+	return out;
+}
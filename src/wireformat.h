@@ -0,0 +1,75 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WIREFORMAT_h
+#define WIREFORMAT_h
+
+#include <Arduino.h>
+
+#include "messages.h"
+#include "settings.h"
+
+/**
+ * Compact binary encoding accepted on AWS_WAKE_CHANNEL_BINARY, same semantics as the JSON messages.
+ * Multi-byte integers are big endian, MACs/passwords are raw 6 bytes and IPs raw 4 bytes.
+ *
+ * Request:  [message id] then
+ *   1 wake:        [device] [topic]
+ *   2 status:      [device] [topic]
+ *   3 batch wake:  [count] [topic] count * [device]
+ *   [topic]  = [length] [length bytes], length 0 when there is none
+ *   [device] = [flags] then
+ *     WIRE_DEVICE_ID set:  [registry id]  (MAC, port, IP, SecureOn and a missing topic come from the registry)
+ *     otherwise:           [MAC 6] [port 2]
+ *     WIRE_IP:             [IP 4]  (otherwise resolved from the discovery table)
+ *     WIRE_SECURE_ON:      [password 6]
+ *     WIRE_STATUS:         retrieve status after the wake
+ *     WIRE_PROBE_*:        status check method, PROBE_DEFAULT when none is set
+ *     WIRE_DIRECTED:       [broadcast address 4]  directed broadcast instead of the local one
+ *     WIRE_UNICAST:        unicast to the IP (or the discovered one) with a static ARP entry
+ *
+ * Replies:
+ *   WIRE_STATUS_REPLY:  [0x82] [count] count * ([MAC 6] [result 1] [probeMethod 1] [rtt 4, microseconds] [elapsed 4, milliseconds])
+ *                       result 0 with probeMethod PROBE_BUSY means the status check was refused, not that the host is down
+ *   WIRE_BATCH_ACK:     [0x83] [devices] [sent] [statusQueued] [queued] [eta 4, milliseconds until the last queued wake]
+ *   WIRE_WAKE_QUEUED:   [0x84] [MAC 6] [position] [eta 4, milliseconds]
+ */
+#define WIRE_DEVICE_ID 0x01
+#define WIRE_IP 0x02
+#define WIRE_SECURE_ON 0x04
+#define WIRE_STATUS 0x08
+#define WIRE_PROBE_MASK 0x30
+#define WIRE_PROBE_ICMP 0x10
+#define WIRE_PROBE_ARP 0x20
+#define WIRE_PROBE_AUTO 0x30
+#define WIRE_DIRECTED 0x40
+#define WIRE_UNICAST 0x80
+
+#define WIRE_STATUS_REPLY 0x82
+#define WIRE_BATCH_ACK 0x83
+#define WIRE_WAKE_QUEUED 0x84
+
+bool wireDecodeWake(const uint8_t *data, size_t length, wakeMessageStruct *device);
+bool wireDecodeStatus(const uint8_t *data, size_t length, statusMessageStruct *status);
+bool wireDecodeBatch(const uint8_t *data, size_t length, wakeBatchStruct *batch);
+
+size_t wireEncodeStatus(const statusResultStruct *results, uint8_t count, uint8_t *out, size_t size);
+size_t wireEncodeBatchAck(uint8_t devices, uint8_t sent, uint8_t statusQueued, uint8_t queued, uint32_t etaMillis, uint8_t *out, size_t size);
+size_t wireEncodeWakeQueued(const uint8_t *mac, uint8_t position, uint32_t etaMillis, uint8_t *out, size_t size);
+
+#endif
@@ -0,0 +1,206 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * Frame fixtures for announceParseArp() and announceParseDhcp(), run with: pio test -e native -f test_announce
+ * ARP fixtures are the 28 byte ARP header as etharp_input() hands it over,
+ * DHCP fixtures the UDP payload given to the port 67 pcb.
+ */
+
+#include <unity.h>
+
+#include "announce.h"
+
+#define DHCP_FIXTURE_OPTIONS 240  // BOOTP header and magic cookie
+#define DHCP_FIXTURE_SIZE 300
+
+const uint8_t hostMac[MAC_ADDRESS_SIZE] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB};
+
+// Gratuitous ARP request from 01:23:45:67:89:AB for 192.168.1.20
+const uint8_t arpGratuitous[] = {0x00, 0x01, 0x08, 0x00, 0x06, 0x04, 0x00, 0x01,
+                                 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 192, 168, 1, 20,
+                                 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 192, 168, 1, 20};
+
+// RFC 5227 probe: sender IP 0, asking who has 192.168.1.20
+const uint8_t arpProbe[] = {0x00, 0x01, 0x08, 0x00, 0x06, 0x04, 0x00, 0x01,
+                            0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0, 0, 0, 0,
+                            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 192, 168, 1, 20};
+
+// Ordinary request from 192.168.1.20 for its gateway
+const uint8_t arpRequest[] = {0x00, 0x01, 0x08, 0x00, 0x06, 0x04, 0x00, 0x01,
+                              0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 192, 168, 1, 20,
+                              0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 192, 168, 1, 1};
+
+// Gratuitous, but claiming an 8 byte hardware address
+const uint8_t arpWrongLength[] = {0x00, 0x01, 0x08, 0x00, 0x08, 0x04, 0x00, 0x01,
+                                  0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 192, 168, 1, 20,
+                                  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 192, 168, 1, 20};
+
+// DHCP options, all after the magic cookie
+const uint8_t optionsDiscover[] = {53, 1, 1, 50, 4, 192, 168, 1, 20, 55, 3, 1, 3, 6, 255};
+const uint8_t optionsRequest[] = {53, 1, 3, 61, 7, 1, 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0, 0, 50, 4, 192, 168, 1, 20, 255};
+const uint8_t optionsRenew[] = {53, 1, 3, 55, 3, 1, 3, 6, 255};
+const uint8_t optionsFreshDiscover[] = {53, 1, 1, 55, 3, 1, 3, 6, 255};
+const uint8_t optionsOffer[] = {53, 1, 2, 54, 4, 192, 168, 1, 1, 255};
+const uint8_t optionsCutRequestedIP[] = {53, 1, 3, 50, 4, 10, 0};       // option 50 runs past the end of the payload
+const uint8_t optionsCutMessageType[] = {50, 4, 192, 168, 1, 20, 53, 1};  // message type value missing
+
+uint8_t frame[DHCP_FIXTURE_SIZE];
+
+// Bytes past a fixture are not zero, so reading beyond the given length shows up in the result
+void setUp() {
+	memset(frame, 0xEE, sizeof(frame));
+}
+
+void tearDown() {}
+
+uint32_t ipAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+	return IPAddress(a, b, c, d);
+}
+
+// BOOTREQUEST from hostMac with the given options, returns the payload length
+size_t dhcpFrame(uint8_t hardwareLength, uint32_t ciaddr, const uint8_t *options, size_t optionsLength) {
+	static const uint8_t cookie[] = {0x63, 0x82, 0x53, 0x63};
+
+	memset(frame, 0, DHCP_FIXTURE_OPTIONS);
+	frame[0] = 1;  // BOOTREQUEST
+	frame[1] = 1;  // Ethernet
+	frame[2] = hardwareLength;
+	memcpy(frame + 4, "\x3A\x7C\x91\x05", 4);  // xid
+	memcpy(frame + 12, &ciaddr, sizeof(ciaddr));
+	memcpy(frame + 28, hostMac, MAC_ADDRESS_SIZE);
+	memcpy(frame + 236, cookie, sizeof(cookie));
+	memcpy(frame + DHCP_FIXTURE_OPTIONS, options, optionsLength);
+
+	return DHCP_FIXTURE_OPTIONS + optionsLength;
+}
+
+void testArpGratuitous() {
+	announceStruct announce;
+
+	TEST_ASSERT_TRUE(announceParseArp(arpGratuitous, sizeof(arpGratuitous), &announce));
+	TEST_ASSERT_EQUAL_HEX8_ARRAY(hostMac, announce.mac, MAC_ADDRESS_SIZE);
+	TEST_ASSERT_EQUAL_HEX32(ipAddress(192, 168, 1, 20), announce.ip);
+	TEST_ASSERT_EQUAL(ANNOUNCE_ARP, announce.source);
+}
+
+void testArpProbe() {
+	announceStruct announce;
+
+	TEST_ASSERT_TRUE(announceParseArp(arpProbe, sizeof(arpProbe), &announce));
+	TEST_ASSERT_EQUAL_HEX8_ARRAY(hostMac, announce.mac, MAC_ADDRESS_SIZE);
+	TEST_ASSERT_EQUAL_HEX32(0, announce.ip);
+}
+
+void testArpNotGratuitous() {
+	announceStruct announce;
+
+	TEST_ASSERT_FALSE(announceParseArp(arpRequest, sizeof(arpRequest), &announce));
+}
+
+void testArpWrongHardwareLength() {
+	announceStruct announce;
+
+	TEST_ASSERT_FALSE(announceParseArp(arpWrongLength, sizeof(arpWrongLength), &announce));
+}
+
+void testArpTruncated() {
+	announceStruct announce;
+
+	TEST_ASSERT_FALSE(announceParseArp(arpGratuitous, sizeof(arpGratuitous) - 1, &announce));
+}
+
+void testDhcpDiscover() {
+	announceStruct announce;
+	size_t length = dhcpFrame(MAC_ADDRESS_SIZE, 0, optionsDiscover, sizeof(optionsDiscover));
+
+	TEST_ASSERT_TRUE(announceParseDhcp(frame, length, &announce));
+	TEST_ASSERT_EQUAL_HEX8_ARRAY(hostMac, announce.mac, MAC_ADDRESS_SIZE);
+	TEST_ASSERT_EQUAL_HEX32(ipAddress(192, 168, 1, 20), announce.ip);
+	TEST_ASSERT_EQUAL(ANNOUNCE_DHCP, announce.source);
+}
+
+// Pad options before option 50 must be skipped one byte at a time
+void testDhcpRequest() {
+	announceStruct announce;
+	size_t length = dhcpFrame(MAC_ADDRESS_SIZE, 0, optionsRequest, sizeof(optionsRequest));
+
+	TEST_ASSERT_TRUE(announceParseDhcp(frame, length, &announce));
+	TEST_ASSERT_EQUAL_HEX8_ARRAY(hostMac, announce.mac, MAC_ADDRESS_SIZE);
+	TEST_ASSERT_EQUAL_HEX32(ipAddress(192, 168, 1, 20), announce.ip);
+}
+
+// Without option 50 the renewing client's ciaddr is used, a fresh DISCOVER has no IP at all
+void testDhcpRequestedIPMissing() {
+	announceStruct announce;
+	size_t length = dhcpFrame(MAC_ADDRESS_SIZE, ipAddress(192, 168, 1, 20), optionsRenew, sizeof(optionsRenew));
+
+	TEST_ASSERT_TRUE(announceParseDhcp(frame, length, &announce));
+	TEST_ASSERT_EQUAL_HEX32(ipAddress(192, 168, 1, 20), announce.ip);
+
+	length = dhcpFrame(MAC_ADDRESS_SIZE, 0, optionsFreshDiscover, sizeof(optionsFreshDiscover));
+	TEST_ASSERT_TRUE(announceParseDhcp(frame, length, &announce));
+	TEST_ASSERT_EQUAL_HEX32(0, announce.ip);
+}
+
+// An option running past the payload ends parsing, nothing beyond the length is read
+void testDhcpTruncatedOptions() {
+	announceStruct announce;
+	size_t length = dhcpFrame(MAC_ADDRESS_SIZE, 0, optionsCutRequestedIP, sizeof(optionsCutRequestedIP));
+
+	TEST_ASSERT_TRUE(announceParseDhcp(frame, length, &announce));
+	TEST_ASSERT_EQUAL_HEX32(0, announce.ip);
+
+	length = dhcpFrame(MAC_ADDRESS_SIZE, 0, optionsCutMessageType, sizeof(optionsCutMessageType));
+	TEST_ASSERT_FALSE(announceParseDhcp(frame, length, &announce));
+
+	// Cut inside the BOOTP header, before the options start
+	dhcpFrame(MAC_ADDRESS_SIZE, 0, optionsDiscover, sizeof(optionsDiscover));
+	TEST_ASSERT_FALSE(announceParseDhcp(frame, DHCP_FIXTURE_OPTIONS - 1, &announce));
+}
+
+void testDhcpWrongHardwareLength() {
+	announceStruct announce;
+	size_t length = dhcpFrame(8, 0, optionsDiscover, sizeof(optionsDiscover));
+
+	TEST_ASSERT_FALSE(announceParseDhcp(frame, length, &announce));
+}
+
+// Server side messages are not announcements
+void testDhcpOffer() {
+	announceStruct announce;
+	size_t length = dhcpFrame(MAC_ADDRESS_SIZE, 0, optionsOffer, sizeof(optionsOffer));
+
+	TEST_ASSERT_FALSE(announceParseDhcp(frame, length, &announce));
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(testArpGratuitous);
+	RUN_TEST(testArpProbe);
+	RUN_TEST(testArpNotGratuitous);
+	RUN_TEST(testArpWrongHardwareLength);
+	RUN_TEST(testArpTruncated);
+	RUN_TEST(testDhcpDiscover);
+	RUN_TEST(testDhcpRequest);
+	RUN_TEST(testDhcpRequestedIPMissing);
+	RUN_TEST(testDhcpTruncatedOptions);
+	RUN_TEST(testDhcpWrongHardwareLength);
+	RUN_TEST(testDhcpOffer);
+	return UNITY_END();
+}
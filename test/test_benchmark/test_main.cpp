@@ -0,0 +1,282 @@
+/**
+ * Wake Device
+ * Copyright (C) 2019 Ahmed Al-Qaidom
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * Hot path benchmark, run on the host with: pio test -e native -f test_benchmark -v
+ * Each case times BENCHMARK_RUNS iterations, prints the cost per run and fails if any run did.
+ * Host timings only compare formats and algorithms with each other, they are not device timings.
+ */
+
+#include <unity.h>
+
+#include "announce.h"
+#include "cron.h"
+#include "deadlineheap.h"
+#include "dedup.h"
+#include "jsonformat.h"
+#include "magicpacket.h"
+#include "tracing.h"
+#include "wakeguard.h"
+#include "wireformat.h"
+
+const char statusJSON[] = "{\"id\":2,\"MAC\":\"01:23:45:67:89:AB\",\"ip\":\"192.168.1.20\",\"topic\":\"wakeStatus/1\"}";
+const char batchJSON[] = "{\"id\":3,\"topic\":\"wakeStatus/1\",\"retrieveStatus\":true,\"devices\":["
+                         "{\"MAC\":\"01:23:45:67:89:AB\",\"ip\":\"192.168.1.20\"},"
+                         "{\"MAC\":\"01:23:45:67:89:AC\",\"ip\":\"192.168.1.21\"},"
+                         "{\"MAC\":\"01:23:45:67:89:AD\",\"ip\":\"192.168.1.22\",\"secureOn\":true,\"secureOnPassword\":\"01:02:03:04:05:06\"}]}";
+// Same wake request (MAC, port, IP, topic, SecureOn) in both wire formats
+const char wakeJSON[] = "{\"id\":1,\"MAC\":\"01:23:45:67:89:AB\",\"port\":9,\"retrieveStatus\":true,\"topic\":\"wakeStatus/1\","
+                        "\"ip\":\"192.168.1.20\",\"secureOn\":true,\"secureOnPassword\":\"01:02:03:04:05:06\"}";
+const uint8_t wakeBinary[] = {1, WIRE_IP | WIRE_SECURE_ON | WIRE_STATUS,
+                              0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0, 9,
+                              192, 168, 1, 20,
+                              0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+                              12, 'w', 'a', 'k', 'e', 'S', 't', 'a', 't', 'u', 's', '/', '1'};
+const uint8_t secureOn[SECURE_ON_SIZE] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06};
+
+// Gratuitous ARP request from 01:23:45:67:89:AB for 192.168.1.20
+const uint8_t gratuitousArp[] = {0x00, 0x01, 0x08, 0x00, 0x06, 0x04, 0x00, 0x01,
+                                 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 192, 168, 1, 20,
+                                 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 192, 168, 1, 20};
+
+StaticJsonDocument<MESSAGE_JSON_SIZE> messageDoc;
+
+void setUp() {}
+void tearDown() {}
+
+void benchmarkReport(const char *name, unsigned long elapsedMicros, uint32_t runs, bool ok) {
+	printf(" | %-22s %8.2fus%s\n", name, runs > 0 ? (float)elapsedMicros / runs : 0, ok ? "" : " | FAILED");
+	TEST_ASSERT_TRUE_MESSAGE(ok, name);
+}
+
+void benchmarkWireFormat() {
+	char buffer[sizeof(wakeJSON)];
+	wakeMessageStruct fromJSON, fromBinary;
+	unsigned long start = micros();
+	bool ok = true;
+
+	for (uint16_t i = 0; i < BENCHMARK_RUNS; i++) {
+		// deserializeJson() rewrites the buffer in place, so each pass gets a fresh copy
+		memcpy(buffer, wakeJSON, sizeof(wakeJSON));
+		ok &= !deserializeJson(messageDoc, buffer, sizeof(wakeJSON) - 1) && parseWakeMessage(messageDoc.as<JsonObject>(), &fromJSON);
+	}
+	printf(" | JSON %u bytes", (unsigned)(sizeof(wakeJSON) - 1));
+	benchmarkReport("parse wake JSON", micros() - start, BENCHMARK_RUNS, ok);
+
+	ok = true;
+	start = micros();
+	for (uint16_t i = 0; i < BENCHMARK_RUNS; i++)
+		ok &= wireDecodeWake(wakeBinary, sizeof(wakeBinary), &fromBinary);
+	printf(" | binary %u bytes", (unsigned)sizeof(wakeBinary));
+	benchmarkReport("decode wake binary", micros() - start, BENCHMARK_RUNS, ok);
+
+	TEST_ASSERT_EQUAL_HEX8_ARRAY(fromJSON.mac, fromBinary.mac, MAC_ADDRESS_SIZE);
+	TEST_ASSERT_EQUAL(fromJSON.port, fromBinary.port);
+	TEST_ASSERT_EQUAL_HEX32(fromJSON.ip, fromBinary.ip);
+	TEST_ASSERT_EQUAL_HEX8_ARRAY(fromJSON.secureOnPassword, fromBinary.secureOnPassword, SECURE_ON_SIZE);
+	TEST_ASSERT_EQUAL_STRING(fromJSON.topic, fromBinary.topic);
+}
+
+void benchmarkParseStatus() {
+	char buffer[sizeof(statusJSON)];
+	statusMessageStruct status;
+	unsigned long start = micros();
+	bool ok = true;
+
+	for (uint16_t i = 0; i < BENCHMARK_RUNS; i++) {
+		// deserializeJson() rewrites the buffer in place, so each pass gets a fresh copy
+		memcpy(buffer, statusJSON, sizeof(statusJSON));
+		ok &= !deserializeJson(messageDoc, buffer, sizeof(statusJSON) - 1) && parseStatusMessage(messageDoc.as<JsonObject>(), &status);
+	}
+	benchmarkReport("parse status JSON", micros() - start, BENCHMARK_RUNS, ok);
+}
+
+void benchmarkParseBatch() {
+	static wakeBatchStruct batch;
+	char buffer[sizeof(batchJSON)];
+	unsigned long start = micros();
+	bool ok = true;
+
+	for (uint16_t i = 0; i < BENCHMARK_RUNS; i++) {
+		memcpy(buffer, batchJSON, sizeof(batchJSON));
+		ok &= !deserializeJson(messageDoc, buffer, sizeof(batchJSON) - 1) && parseWakeBatch(messageDoc.as<JsonObject>(), &batch);
+	}
+	benchmarkReport("parse batch JSON (3)", micros() - start, BENCHMARK_RUNS, ok && batch.count == 3);
+}
+
+void benchmarkMagicPacket() {
+	uint8_t packet[SECURE_MAGIC_PACKET_SIZE];
+	uint8_t mac[MAC_ADDRESS_SIZE] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB};
+	size_t size;
+	unsigned long start = micros();
+	bool ok = true;
+
+	for (uint16_t i = 0; i < BENCHMARK_RUNS; i++)
+		ok &= buildMagicPacket(packet, mac, secureOn) == SECURE_MAGIC_PACKET_SIZE;
+	benchmarkReport("build magic packet", micros() - start, BENCHMARK_RUNS, ok);
+
+	ok = true;
+	start = micros();
+	for (uint16_t i = 0; i < BENCHMARK_RUNS; i++)
+		ok &= magicPacketCacheGet(mac, secureOn, &size) != NULL;
+	benchmarkReport("magic packet cache", micros() - start, BENCHMARK_RUNS, ok);
+	magicPacketCacheInvalidate();
+}
+
+// Fill a whole ICMP queue worth of deadlines, then run the schedule dry the way icmpTask() does
+void benchmarkDeadlineHeap() {
+	deadlineHeapStruct heap;
+	uint8_t slot;
+	unsigned long deadline;
+	unsigned long start = micros();
+	bool ok = true;
+
+	deadlineHeapInit(&heap);
+	for (uint16_t i = 0; i < BENCHMARK_RUNS / ICMP_QUEUE_SIZE; i++) {
+		for (uint8_t j = 0; j < ICMP_QUEUE_SIZE; j++)
+			deadlineHeapSet(&heap, j, 1000 + (j * 7919) % 5000);
+
+		unsigned long previous = 0;
+		while (deadlineHeapPeek(&heap, &slot, &deadline)) {
+			ok &= deadline >= previous;
+			previous = deadline;
+			deadlineHeapRemove(&heap, slot);
+		}
+	}
+	benchmarkReport("ICMP schedule", micros() - start, (BENCHMARK_RUNS / ICMP_QUEUE_SIZE) * ICMP_QUEUE_SIZE, ok);
+}
+
+// Worst case for the JSON reply: longest method name and the most rtt and elapsed digits
+void statusBatchFill(statusCoalesceStruct *batch, messageFormat format) {
+	batch->format = format;
+	batch->count = STATUS_COALESCE_MAX;
+
+	for (uint8_t j = 0; j < STATUS_COALESCE_MAX; j++) {
+		uint8_t mac[MAC_ADDRESS_SIZE] = {0x01, 0x23, 0x45, 0x67, 0x89, j};
+
+		memcpy(batch->results[j].mac, mac, MAC_ADDRESS_SIZE);
+		batch->results[j].status = true;
+		batch->results[j].method = PROBE_ANNOUNCE;
+		batch->results[j].rttMicros = 1499999;
+		batch->results[j].elapsedMillis = 4294967295UL;
+		batch->results[j].traceId = j + 1;
+	}
+}
+
+void benchmarkStatusReply() {
+	statusCoalesceStruct batch;
+	char data[MQTT_PAYLOAD_SIZE];
+	uint16_t traceIds[STATUS_COALESCE_MAX];
+	uint8_t traceCount, answered;
+	size_t length;
+	unsigned long start;
+	bool ok;
+
+	for (uint8_t format = FORMAT_JSON; format <= FORMAT_BINARY; format++) {
+		ok = true;
+		start = micros();
+		for (uint16_t i = 0; i < BENCHMARK_RUNS; i++) {
+			statusBatchFill(&batch, (messageFormat)format);
+
+			while (batch.count > 0)
+				ok &= statusCoalesceSerialize(&batch, data, sizeof(data), traceIds, &traceCount) > 0;
+		}
+		benchmarkReport(format == FORMAT_JSON ? "status reply JSON" : "status reply binary", micros() - start, BENCHMARK_RUNS, ok);
+	}
+
+	// A full JSON batch may not fit one payload: every part must still be complete JSON and together answer every request
+	statusBatchFill(&batch, FORMAT_JSON);
+	answered = 0;
+	while (batch.count > 0) {
+		length = statusCoalesceSerialize(&batch, data, sizeof(data), traceIds, &traceCount);
+
+		TEST_ASSERT_TRUE(length < sizeof(data));
+		TEST_ASSERT_FALSE(deserializeJson(messageDoc, data, length));
+		TEST_ASSERT_EQUAL(answered + 1, traceIds[0]);
+		answered += traceCount;
+	}
+	TEST_ASSERT_EQUAL(STATUS_COALESCE_MAX, answered);
+}
+
+void benchmarkDuplicates() {
+	uint8_t mac[MAC_ADDRESS_SIZE] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB};
+	unsigned long start = micros();
+	bool ok = wakeGuardClaim(mac);
+
+	// Every further claim falls inside WAKE_SUPPRESS_MS of the first
+	for (uint16_t i = 1; i < BENCHMARK_RUNS; i++)
+		ok &= !wakeGuardClaim(mac);
+	benchmarkReport("wake guard claim", micros() - start, BENCHMARK_RUNS, ok);
+
+	ok = true;
+	start = micros();
+	for (uint16_t i = 0; i < BENCHMARK_RUNS; i++) {
+		uint32_t key = dedupHash(statusJSON, sizeof(statusJSON) - 1) + i;
+
+		ok &= !dedupSeen(DEDUP_REQUEST, key);
+		dedupRecord(DEDUP_REQUEST, key);
+		ok &= dedupSeen(DEDUP_REQUEST, key);
+	}
+	benchmarkReport("dedup record", micros() - start, BENCHMARK_RUNS, ok);
+
+	// A full window evicts the oldest entry, so the last DEDUP_SIZE requests are all still known
+	for (uint16_t i = BENCHMARK_RUNS - DEDUP_SIZE; i < BENCHMARK_RUNS; i++)
+		TEST_ASSERT_TRUE(dedupSeen(DEDUP_REQUEST, dedupHash(statusJSON, sizeof(statusJSON) - 1) + i));
+}
+
+void benchmarkCron() {
+	cronStruct cron;
+	time_t next = 1700000000;
+	unsigned long start = micros();
+	bool ok = cronParse("*/15 9-17 * * 1-5", &cron);
+
+	for (uint16_t i = 0; i < BENCHMARK_RUNS && ok; i++) {
+		time_t previous = next;
+
+		// At or after, so step past the last match
+		next = cronNext(&cron, next + 1);
+		ok &= next > previous;
+	}
+	benchmarkReport("cron next", micros() - start, BENCHMARK_RUNS, ok);
+}
+
+void benchmarkAnnounce() {
+	announceStruct announce;
+	unsigned long start = micros();
+	bool ok = true;
+
+	for (uint16_t i = 0; i < BENCHMARK_RUNS; i++)
+		ok &= announceParseArp(gratuitousArp, sizeof(gratuitousArp), &announce);
+	benchmarkReport("announce ARP", micros() - start, BENCHMARK_RUNS, ok);
+}
+
+int main(int argc, char **argv) {
+	printf("Hot path benchmark (%u runs)\n", BENCHMARK_RUNS);
+
+	UNITY_BEGIN();
+	RUN_TEST(benchmarkWireFormat);
+	RUN_TEST(benchmarkParseStatus);
+	RUN_TEST(benchmarkParseBatch);
+	RUN_TEST(benchmarkMagicPacket);
+	RUN_TEST(benchmarkDeadlineHeap);
+	RUN_TEST(benchmarkStatusReply);
+	RUN_TEST(benchmarkDuplicates);
+	RUN_TEST(benchmarkCron);
+	RUN_TEST(benchmarkAnnounce);
+	return UNITY_END();
+}